@@ -1,6 +1,12 @@
 #include "provided.h"
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <queue>
+#include <cmath>
+#include <cstdint>
 #include "MyMap.h"
+#include "support.h"
 
 using namespace std;
 
@@ -10,13 +16,219 @@ public:
     AttractionMapperImpl();
     ~AttractionMapperImpl();
     void init(const MapLoader& ml);
-    bool getGeoCoord(string attraction, GeoCoord& gc) const;
+    bool getGeoCoord(const string& attraction, GeoCoord& gc) const;
+    size_t getGeoCoords(const string* names, size_t count, GeoCoord* coords, bool* found) const;
+    vector<Attraction> nearestAttractions(const GeoCoord& gc, size_t k) const;
+    vector<Attraction> attractionsWithinRadius(const GeoCoord& gc, double km) const;
+    vector<Attraction> complete(const string& prefix, size_t k) const;
+    bool setCompletionWeight(const string& attraction, double weight);
+    vector<Attraction> fuzzyMatches(const string& name, size_t k, size_t maxEdits) const;
+    void addMemoryUsage(MemoryUsage& usage) const;
 private:
-    MyMap<string, GeoCoord>m_map;
+    MemoryCounter m_mem;
+    
+    // KD-tree over the attractions as points on the unit sphere. Straight-line (chord)
+    // distance there grows with great-circle distance, so nearest by one is nearest by the
+    // other, and there's no wrapping at the date line to worry about. The tree is implicit:
+    // the node for a range of m_kd is its middle element, split on m_kd[mid].axis.
+    struct KdPoint
+    {
+        double p[3];
+        size_t place; //index into m_places
+        unsigned char axis;
+    };
+    TrackedVector<Attraction> m_places;
+    TrackedVector<KdPoint> m_kd;
+    
+    typedef pair<double, size_t> Hit; //squared chord, index into m_kd
+    void buildKd(size_t lo, size_t hi);
+    void nearest(size_t lo, size_t hi, const double* q, size_t k, priority_queue<Hit>& best) const;
+    void within(size_t lo, size_t hi, const double* q, double r2, vector<Hit>& hits) const;
+    vector<Attraction> sorted(vector<Hit>& hits) const;
+    
+    // Radix trie over the lowercased names, for complete. Each node's edge label is a slice
+    // of m_trieText and its children sit next to each other in m_trie, in order of first
+    // character. maxWeight is the best weight anywhere under the node, so complete can skip
+    // whole subtrees; first is the node's alphabetically first name (a position in m_byName),
+    // which breaks ties.
+    struct TrieNode
+    {
+        size_t labelStart, labelLength;
+        size_t firstChild, numChildren;
+        size_t place; //the attraction whose name ends here, or NO_PLACE
+        size_t first;
+        double maxWeight;
+    };
+    static const size_t NO_PLACE = size_t(-1);
+    TrackedVector<TrieNode> m_trie;
+    string m_trieText;
+    TrackedVector<size_t> m_byName; //m_places indexes in name order
+    TrackedVector<double> m_weight; //per place
+    
+    void buildTrie();
+    void buildTrieNode(const vector<string>& names, size_t lo, size_t hi, size_t depth, size_t node);
+    size_t findChild(size_t node, const string& key, size_t matched, bool partial) const;
+    double subtreeMax(size_t node) const;
+    
+    // Trigram index for fuzzyMatches: each place's lowercased name, padded at both ends, cut
+    // into overlapping 3-character pieces. The places containing m_gramKeys[i] are
+    // m_gramPlaces[m_gramStart[i], m_gramStart[i + 1]). Names themselves are back to back
+    // in m_lowerText, place i's from m_lowerStart[i] to m_lowerStart[i + 1].
+    TrackedVector<uint32_t> m_gramKeys;
+    TrackedVector<size_t> m_gramStart;
+    TrackedVector<uint32_t> m_gramPlaces;
+    string m_lowerText;
+    TrackedVector<size_t> m_lowerStart;
+    
+    void buildGrams();
+    
+    // Minimal perfect hash over the lowercased names, for getGeoCoord (hash and displace, as
+    // in CHD). A name's hash picks its bucket; each bucket has a pilot, found at init, that
+    // sends the bucket's names to slots no other name uses. So a lookup is one hash, one
+    // slot and one compare against the name that owns it.
+    TrackedVector<uint32_t> m_pilots; //per bucket
+    TrackedVector<uint32_t> m_slotPlace;
+    uint64_t m_hashSeed;
+    
+    void buildNameHash();
+    size_t bucketOf(uint64_t h) const { return size_t(((h & 0xffffffff) * m_pilots.size()) >> 32); }
+    size_t slotOf(uint64_t h, uint32_t pilot) const;
 };
 
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
+namespace {
+
+void toUnitSphere(const GeoCoord& gc, double* p)
+{
+    double lat = deg2rad(gc.latitude), lon = deg2rad(gc.longitude);
+    p[0] = cos(lat) * cos(lon);
+    p[1] = cos(lat) * sin(lon);
+    p[2] = sin(lat);
+}
+
+double squaredDistance(const double* a, const double* b)
+{
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// The distinct trigrams of s, padded with two zero characters either side. An edit touches
+// at most three of them, so a name within d edits shares all but 3d of them.
+void trigrams(const string& s, vector<uint32_t>& grams)
+{
+    grams.clear();
+    uint32_t gram = 0;
+    for (size_t i = 0; i != s.size() + 2; i++)
+    {
+        unsigned char c = i < s.size() ? (unsigned char)s[i] : 0;
+        gram = ((gram << 8) | c) & 0xffffff;
+        grams.push_back(gram);
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+}
+
+// Levenshtein distance by Myers' bit-vector algorithm, in Hyyrö's form for whole strings:
+// one bit per pattern character, so a pattern of up to 64 takes a handful of word
+// operations per text character. Longer patterns get the plain dynamic program.
+class EditDistance
+{
+public:
+    EditDistance(const string& pattern)
+    : m_pattern(pattern)
+    {
+        fill(m_peq, m_peq + 256, 0);
+        for (size_t i = 0; i < pattern.size() && i < 64; i++)
+            m_peq[(unsigned char)pattern[i]] |= uint64_t(1) << i;
+    }
+    
+    // The distance to text, or bound + 1 if it's more than bound
+    size_t within(const char* text, size_t n, size_t bound) const
+    {
+        size_t m = m_pattern.size();
+        if (m > 64)
+            return slowWithin(text, n, bound);
+        if (m == 0)
+            return n <= bound ? n : bound + 1;
+        uint64_t pv = ~uint64_t(0), mv = 0, last = uint64_t(1) << (m - 1);
+        size_t score = m;
+        for (size_t j = 0; j != n; j++)
+        {
+            uint64_t eq = m_peq[(unsigned char)text[j]];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            if (ph & last)
+                score++;
+            else if (mh & last)
+                score--;
+            ph = (ph << 1) | 1; //the top row goes up by one per column
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            if (score > bound + (n - j - 1)) //each character left can take off at most one
+                return bound + 1;
+        }
+        return score <= bound ? score : bound + 1;
+    }
+private:
+    const string& m_pattern;
+    uint64_t m_peq[256]; //bit i set where pattern[i] is that character
+    
+    size_t slowWithin(const char* text, size_t n, size_t bound) const
+    {
+        size_t m = m_pattern.size();
+        vector<size_t> row(m + 1), next(m + 1);
+        for (size_t i = 0; i <= m; i++)
+            row[i] = i;
+        for (size_t j = 0; j != n; j++)
+        {
+            next[0] = j + 1;
+            size_t best = next[0];
+            for (size_t i = 1; i <= m; i++)
+            {
+                next[i] = min(min(row[i], next[i - 1]) + 1, row[i - 1] + (m_pattern[i - 1] != text[j]));
+                best = min(best, next[i]);
+            }
+            if (best > bound)
+                return bound + 1;
+            row.swap(next);
+        }
+        return row[m] <= bound ? row[m] : bound + 1;
+    }
+};
+
+// Kept between queries so each only pays for the places it touches
+struct FuzzyScratch
+{
+    vector<bool> seen; //per place, all false between queries
+    vector<uint32_t> touched;
+    vector<uint32_t> grams;
+};
+
+thread_local FuzzyScratch t_fuzzy;
+
+} // namespace
+
 AttractionMapperImpl::AttractionMapperImpl()
+: m_places(&m_mem), m_kd(&m_mem), m_trie(&m_mem), m_byName(&m_mem), m_weight(&m_mem),
+  m_gramKeys(&m_mem), m_gramStart(&m_mem), m_gramPlaces(&m_mem), m_lowerStart(&m_mem),
+  m_pilots(&m_mem), m_slotPlace(&m_mem), m_hashSeed(0)
+{
+}
+
+void AttractionMapperImpl::addMemoryUsage(MemoryUsage& usage) const
 {
+    usage.attractionIndex += m_mem.bytes;
+    for (size_t i = 0; i != m_places.size(); i++)
+        usage.attractionIndex += heapBytes(m_places[i]);
+    usage.attractionIndex += heapBytes(m_trieText) + heapBytes(m_lowerText);
 }
 
 AttractionMapperImpl::~AttractionMapperImpl()
@@ -27,36 +239,567 @@ AttractionMapperImpl::~AttractionMapperImpl()
 
 void AttractionMapperImpl::init(const MapLoader& ml)
 {
+    TraceScope trace("AttractionMapper::init");
+    m_places.clear(); //init may be called again when the map is reloaded
+    m_kd.clear();
+    MyMap<string, size_t> seen; //name to index in m_places
     for(int i=0; i!= ml.getNumSegments(); i++)
     {
         StreetSegment seg;
         ml.getSegment(i, seg);
         for (int j = 0; j!= seg.attractions.size(); j++)
         {
-            for (int k=0; k!=seg.attractions.at(j).name.size(); k++)
+            string name = toLowerCase(seg.attractions[j].name);
+            const size_t* place = seen.find(name);
+            if (place == nullptr)
             {
-                if(isupper(seg.attractions[j].name[k])) //try to make lower?
-                    seg.attractions[j].name[k] = tolower(seg.attractions[j].name[k]);
+                seen.associate(name, m_places.size());
+                m_places.push_back(seg.attractions[j]);
             }
-            
-            
-            m_map.associate(seg.attractions[j].name, seg.attractions[j].geocoordinates);
+            else //the same name twice is the same place, and the last coordinates given win
+                m_places[*place].geocoordinates = seg.attractions[j].geocoordinates;
+        }
+    }
+    
+    m_kd.resize(m_places.size());
+    for (size_t i = 0; i != m_places.size(); i++)
+    {
+        toUnitSphere(m_places[i].geocoordinates, m_kd[i].p);
+        m_kd[i].place = i;
+    }
+    buildKd(0, m_kd.size());
+    buildTrie();
+    buildGrams();
+    buildNameHash();
+}
+
+// Median split on whichever axis the range is most spread out along
+void AttractionMapperImpl::buildKd(size_t lo, size_t hi)
+{
+    if (hi - lo <= 1)
+    {
+        if (hi > lo)
+            m_kd[lo].axis = 0;
+        return;
+    }
+    double low[3] = { 2, 2, 2 }, high[3] = { -2, -2, -2 };
+    for (size_t i = lo; i != hi; i++)
+    {
+        for (int a = 0; a != 3; a++)
+        {
+            low[a] = min(low[a], m_kd[i].p[a]);
+            high[a] = max(high[a], m_kd[i].p[a]);
+        }
+    }
+    int axis = 0;
+    for (int a = 1; a != 3; a++)
+        if (high[a] - low[a] > high[axis] - low[axis])
+            axis = a;
+    size_t mid = lo + (hi - lo) / 2;
+    nth_element(m_kd.begin() + lo, m_kd.begin() + mid, m_kd.begin() + hi,
+                [axis](const KdPoint& a, const KdPoint& b) { return a.p[axis] < b.p[axis]; });
+    m_kd[mid].axis = (unsigned char)axis;
+    buildKd(lo, mid);
+    buildKd(mid + 1, hi);
+}
+
+// best holds the k closest so far, farthest on top
+void AttractionMapperImpl::nearest(size_t lo, size_t hi, const double* q, size_t k, priority_queue<Hit>& best) const
+{
+    if (lo >= hi)
+        return;
+    size_t mid = lo + (hi - lo) / 2;
+    const KdPoint& node = m_kd[mid];
+    double d2 = squaredDistance(node.p, q);
+    if (best.size() < k)
+        best.push(Hit(d2, mid));
+    else if (d2 < best.top().first)
+    {
+        best.pop();
+        best.push(Hit(d2, mid));
+    }
+    double diff = q[node.axis] - node.p[node.axis];
+    //the side q is on first; the other only if the splitting plane is closer than the worst we have
+    if (diff < 0)
+    {
+        nearest(lo, mid, q, k, best);
+        if (best.size() < k || diff * diff < best.top().first)
+            nearest(mid + 1, hi, q, k, best);
+    }
+    else
+    {
+        nearest(mid + 1, hi, q, k, best);
+        if (best.size() < k || diff * diff < best.top().first)
+            nearest(lo, mid, q, k, best);
+    }
+}
+
+void AttractionMapperImpl::within(size_t lo, size_t hi, const double* q, double r2, vector<Hit>& hits) const
+{
+    if (lo >= hi)
+        return;
+    size_t mid = lo + (hi - lo) / 2;
+    const KdPoint& node = m_kd[mid];
+    double d2 = squaredDistance(node.p, q);
+    if (d2 <= r2)
+        hits.push_back(Hit(d2, mid));
+    double diff = q[node.axis] - node.p[node.axis];
+    if (diff < 0 || diff * diff <= r2)
+        within(lo, mid, q, r2, hits);
+    if (diff >= 0 || diff * diff <= r2)
+        within(mid + 1, hi, q, r2, hits);
+}
+
+vector<Attraction> AttractionMapperImpl::sorted(vector<Hit>& hits) const
+{
+    sort(hits.begin(), hits.end());
+    vector<Attraction> result;
+    result.reserve(hits.size());
+    for (size_t i = 0; i != hits.size(); i++)
+        result.push_back(m_places[m_kd[hits[i].second].place]);
+    return result;
+}
+
+vector<Attraction> AttractionMapperImpl::nearestAttractions(const GeoCoord& gc, size_t k) const
+{
+    if (k == 0)
+        return vector<Attraction>();
+    double q[3];
+    toUnitSphere(gc, q);
+    priority_queue<Hit> best;
+    nearest(0, m_kd.size(), q, k, best);
+    vector<Hit> hits;
+    while (! best.empty())
+    {
+        hits.push_back(best.top());
+        best.pop();
+    }
+    return sorted(hits);
+}
+
+vector<Attraction> AttractionMapperImpl::attractionsWithinRadius(const GeoCoord& gc, double km) const
+{
+    if (km < 0)
+        return vector<Attraction>();
+    double q[3];
+    toUnitSphere(gc, q);
+    // great-circle distance km on a sphere of radius R is a chord of 2 sin(km / 2R) on the unit sphere
+    const double EARTH_RADIUS_KM = 6371.0; //as distanceEarthKM
+    double angle = min(km / EARTH_RADIUS_KM, 3.14159265358979323846);
+    double chord = 2 * sin(angle / 2) * (1 + 1e-12); //don't lose points right on the edge to rounding
+    vector<Hit> hits;
+    within(0, m_kd.size(), q, chord * chord, hits);
+    return sorted(hits);
+}
+
+void AttractionMapperImpl::buildTrie()
+{
+    m_trie.clear();
+    m_trieText.clear();
+    m_weight.assign(m_places.size(), 0);
+    vector<string> names(m_places.size());
+    m_byName.resize(m_places.size());
+    for (size_t i = 0; i != m_places.size(); i++)
+    {
+        names[i] = toLowerCase(m_places[i].name);
+        m_byName[i] = i;
+    }
+    sort(m_byName.begin(), m_byName.end(), [&names](size_t a, size_t b) { return names[a] < names[b]; });
+    vector<string> sortedNames(names.size());
+    for (size_t i = 0; i != names.size(); i++)
+        sortedNames[i] = names[m_byName[i]];
+    
+    m_trie.resize(1);
+    m_trie[0].labelStart = m_trie[0].labelLength = 0;
+    buildTrieNode(sortedNames, 0, sortedNames.size(), 0, 0);
+}
+
+// Fills in node, which stands for names[lo, hi) - all of which agree on their first depth
+// characters - and everything below it
+void AttractionMapperImpl::buildTrieNode(const vector<string>& names, size_t lo, size_t hi, size_t depth, size_t node)
+{
+    m_trie[node].place = NO_PLACE;
+    m_trie[node].first = lo;
+    m_trie[node].maxWeight = 0;
+    if (lo != hi && names[lo].size() == depth) //they're sorted, so a name ending here comes first
+    {
+        m_trie[node].place = m_byName[lo];
+        lo++;
+    }
+    
+    // one child per distinct next character, labelled with everything its names share
+    vector<size_t> groupStart;
+    for (size_t i = lo; i != hi; i++)
+        if (i == lo || names[i][depth] != names[i - 1][depth])
+            groupStart.push_back(i);
+    groupStart.push_back(hi);
+    size_t firstChild = m_trie.size();
+    m_trie[node].firstChild = firstChild;
+    m_trie[node].numChildren = groupStart.size() - 1;
+    m_trie.resize(firstChild + groupStart.size() - 1);
+    for (size_t g = 0; g + 1 < groupStart.size(); g++)
+    {
+        const string& a = names[groupStart[g]];
+        const string& b = names[groupStart[g + 1] - 1]; //first and last share the least
+        size_t shared = depth;
+        while (shared < a.size() && shared < b.size() && a[shared] == b[shared])
+            shared++;
+        size_t child = firstChild + g;
+        m_trie[child].labelStart = m_trieText.size();
+        m_trie[child].labelLength = shared - depth;
+        m_trieText.append(a, depth, shared - depth);
+        buildTrieNode(names, groupStart[g], groupStart[g + 1], shared, child);
+    }
+}
+
+// The child of node that key continues into after its first matched characters. With
+// partial, key may run out partway along the child's label.
+size_t AttractionMapperImpl::findChild(size_t node, const string& key, size_t matched, bool partial) const
+{
+    const TrieNode& n = m_trie[node];
+    for (size_t c = n.firstChild; c != n.firstChild + n.numChildren; c++)
+    {
+        size_t len = m_trie[c].labelLength;
+        if (partial)
+            len = min(len, key.size() - matched);
+        if (key.compare(matched, len, m_trieText, m_trie[c].labelStart, len) == 0)
+            return c;
+    }
+    return NO_PLACE;
+}
+
+double AttractionMapperImpl::subtreeMax(size_t node) const
+{
+    const TrieNode& n = m_trie[node];
+    double best = n.place != NO_PLACE ? m_weight[n.place] : -HUGE_VAL;
+    for (size_t c = n.firstChild; c != n.firstChild + n.numChildren; c++)
+        best = max(best, m_trie[c].maxWeight);
+    return best;
+}
+
+bool AttractionMapperImpl::setCompletionWeight(const string& attraction, double weight)
+{
+    string name = toLowerCase(attraction);
+    vector<size_t> path(1, 0);
+    size_t matched = 0;
+    while (matched != name.size())
+    {
+        size_t next = findChild(path.back(), name, matched, false);
+        if (next == NO_PLACE)
+            return false;
+        matched += m_trie[next].labelLength;
+        path.push_back(next);
+    }
+    size_t place = m_trie[path.back()].place;
+    if (place == NO_PLACE)
+        return false;
+    m_weight[place] = weight;
+    for (size_t i = path.size(); i-- != 0; )
+        m_trie[path[i]].maxWeight = subtreeMax(path[i]);
+    return true;
+}
+
+// Best-first below wherever the prefix leads. The queue holds nodes, ranked by the best they
+// could still produce, and names, ranked by their own weight; a name comes out only once
+// nothing left in the queue could beat it.
+vector<Attraction> AttractionMapperImpl::complete(const string& prefix, size_t k) const
+{
+    vector<Attraction> result;
+    if (k == 0 || m_places.empty())
+        return result;
+    string p = toLowerCase(prefix);
+    size_t node = 0, matched = 0;
+    while (matched < p.size())
+    {
+        node = findChild(node, p, matched, true);
+        if (node == NO_PLACE)
+            return result;
+        matched += m_trie[node].labelLength;
+    }
+    
+    struct Entry
+    {
+        double weight;
+        size_t first;
+        size_t node;
+        bool isName;
+        bool operator<(const Entry& other) const //priority_queue puts the greatest on top
+        {
+            if (weight != other.weight)
+                return weight < other.weight;
+            if (first != other.first)
+                return first > other.first;
+            return isName < other.isName; //a name before the node it ends at
+        }
+    };
+    priority_queue<Entry> queue;
+    Entry start = { m_trie[node].maxWeight, m_trie[node].first, node, false };
+    queue.push(start);
+    while (! queue.empty() && result.size() != k)
+    {
+        Entry e = queue.top();
+        queue.pop();
+        const TrieNode& n = m_trie[e.node];
+        if (e.isName)
+        {
+            result.push_back(m_places[n.place]);
+            continue;
+        }
+        if (n.place != NO_PLACE)
+        {
+            Entry name = { m_weight[n.place], n.first, e.node, true };
+            queue.push(name);
+        }
+        for (size_t c = n.firstChild; c != n.firstChild + n.numChildren; c++)
+        {
+            Entry child = { m_trie[c].maxWeight, m_trie[c].first, c, false };
+            queue.push(child);
         }
     }
+    return result;
 }
 
-bool AttractionMapperImpl::getGeoCoord(string attraction, GeoCoord& gc) const
+void AttractionMapperImpl::buildGrams()
 {
-    for (int i=0; i!=attraction.size(); i++)
+    m_lowerText.clear();
+    m_lowerStart.assign(1, 0);
+    vector<pair<uint32_t, uint32_t> > postings; //(gram, place)
+    vector<uint32_t> grams;
+    for (size_t i = 0; i != m_places.size(); i++)
     {
-        if(isupper(attraction[i])) //try to make lower?
-            attraction[i] = tolower(attraction[i]);
+        string name = toLowerCase(m_places[i].name);
+        m_lowerText += name;
+        m_lowerStart.push_back(m_lowerText.size());
+        trigrams(name, grams);
+        for (size_t g = 0; g != grams.size(); g++)
+            postings.push_back(make_pair(grams[g], (uint32_t)i));
+    }
+    sort(postings.begin(), postings.end());
+    m_gramKeys.clear();
+    m_gramStart.clear();
+    m_gramPlaces.resize(postings.size());
+    for (size_t i = 0; i != postings.size(); i++)
+    {
+        if (i == 0 || postings[i].first != postings[i - 1].first)
+        {
+            m_gramKeys.push_back(postings[i].first);
+            m_gramStart.push_back(i);
+        }
+        m_gramPlaces[i] = postings[i].second;
+    }
+    m_gramStart.push_back(postings.size());
+}
+
+// A name within maxEdits keeps all but 3 * maxEdits of the query's trigrams, so it must have
+// one of any 3 * maxEdits + 1 of them. Taking the rarest ones, their places are the
+// candidates (every place, for names too short for that to rule anything out), and each is
+// then checked for real.
+vector<Attraction> AttractionMapperImpl::fuzzyMatches(const string& name, size_t k, size_t maxEdits) const
+{
+    vector<Attraction> result;
+    if (k == 0 || m_places.empty())
+        return result;
+    string q = toLowerCase(name);
+    FuzzyScratch& scratch = t_fuzzy;
+    trigrams(q, scratch.grams);
+    scratch.touched.clear();
+    if (scratch.grams.size() <= 3 * maxEdits)
+    {
+        for (size_t i = 0; i != m_places.size(); i++)
+            scratch.touched.push_back((uint32_t)i);
     }
-    if (m_map.find(attraction)==nullptr)
-       return false;
     else
-        gc = *m_map.find(attraction);
-    return true;  // This compiles, but may not be correct
+    {
+        vector<pair<size_t, size_t> > lists; //(length, index into m_gramKeys), missing trigrams count as empty
+        for (size_t g = 0; g != scratch.grams.size(); g++)
+        {
+            size_t i = lower_bound(m_gramKeys.begin(), m_gramKeys.end(), scratch.grams[g]) - m_gramKeys.begin();
+            if (i == m_gramKeys.size() || m_gramKeys[i] != scratch.grams[g])
+                lists.push_back(make_pair(0, m_gramKeys.size()));
+            else
+                lists.push_back(make_pair(m_gramStart[i + 1] - m_gramStart[i], i));
+        }
+        size_t take = 3 * maxEdits + 1;
+        partial_sort(lists.begin(), lists.begin() + take, lists.end());
+        if (scratch.seen.size() < m_places.size())
+            scratch.seen.resize(m_places.size(), false);
+        for (size_t l = 0; l != take; l++)
+        {
+            size_t i = lists[l].second;
+            if (i == m_gramKeys.size())
+                continue;
+            for (size_t p = m_gramStart[i]; p != m_gramStart[i + 1]; p++)
+            {
+                if (! scratch.seen[m_gramPlaces[p]])
+                {
+                    scratch.seen[m_gramPlaces[p]] = true;
+                    scratch.touched.push_back(m_gramPlaces[p]);
+                }
+            }
+        }
+        for (size_t t = 0; t != scratch.touched.size(); t++)
+            scratch.seen[scratch.touched[t]] = false; //ready for the next query
+    }
+    
+    EditDistance distance(q);
+    vector<pair<size_t, uint32_t> > matches; //(edits, place)
+    for (size_t t = 0; t != scratch.touched.size(); t++)
+    {
+        uint32_t place = scratch.touched[t];
+        size_t start = m_lowerStart[place], length = m_lowerStart[place + 1] - start;
+        if (length + maxEdits < q.size() || q.size() + maxEdits < length)
+            continue;
+        size_t edits = distance.within(m_lowerText.data() + start, length, maxEdits);
+        if (edits <= maxEdits)
+            matches.push_back(make_pair(edits, place));
+    }
+    const string& text = m_lowerText;
+    const TrackedVector<size_t>& starts = m_lowerStart;
+    sort(matches.begin(), matches.end(), [&text, &starts](const pair<size_t, uint32_t>& a, const pair<size_t, uint32_t>& b) {
+        if (a.first != b.first)
+            return a.first < b.first;
+        return text.compare(starts[a.second], starts[a.second + 1] - starts[a.second],
+                            text, starts[b.second], starts[b.second + 1] - starts[b.second]) < 0;
+    });
+    for (size_t i = 0; i != matches.size() && i != k; i++)
+        result.push_back(m_places[matches[i].second]);
+    return result;
+}
+
+size_t AttractionMapperImpl::slotOf(uint64_t h, uint32_t pilot) const
+{
+    uint64_t x = (h ^ (pilot * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+    return size_t(((x & 0xffffffff) * m_slotPlace.size()) >> 32);
+}
+
+// Buckets average four names and are placed biggest first, while most slots are still free.
+// The last few are single names hunting for the last few free slots, which takes about n
+// tries each, so pilots get 32 bits. Two names with the same hash, or a bucket that still
+// doesn't fit after many times that, means starting over with another seed.
+void AttractionMapperImpl::buildNameHash()
+{
+    size_t n = m_places.size();
+    m_pilots.clear();
+    m_slotPlace.clear();
+    if (n == 0)
+        return;
+    vector<uint64_t> hashes(n);
+    vector<bool> taken(n);
+    vector<size_t> slots;
+    for (m_hashSeed = 0; ; m_hashSeed++)
+    {
+        for (size_t i = 0; i != n; i++)
+            hashes[i] = foldedHash(m_lowerText.data() + m_lowerStart[i], m_lowerStart[i + 1] - m_lowerStart[i], m_hashSeed);
+        vector<uint64_t> sortedHashes(hashes);
+        sort(sortedHashes.begin(), sortedHashes.end());
+        if (adjacent_find(sortedHashes.begin(), sortedHashes.end()) != sortedHashes.end())
+            continue;
+        m_pilots.assign(n / 4 + 1, 0);
+        m_slotPlace.assign(n, 0);
+        vector<vector<uint32_t> > buckets(m_pilots.size());
+        for (size_t i = 0; i != n; i++)
+            buckets[bucketOf(hashes[i])].push_back((uint32_t)i);
+        vector<size_t> order(buckets.size());
+        for (size_t b = 0; b != order.size(); b++)
+            order[b] = b;
+        stable_sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+        
+        taken.assign(n, false);
+        bool placed = true;
+        for (size_t o = 0; o != order.size() && placed; o++)
+        {
+            const vector<uint32_t>& bucket = buckets[order[o]];
+            if (bucket.empty())
+                break;
+            placed = false;
+            uint64_t tries = min<uint64_t>(64 * uint64_t(n) + 0x10000, 0xffffffff);
+            for (uint64_t pilot = 0; pilot != tries && ! placed; pilot++)
+            {
+                slots.clear();
+                bool fits = true;
+                for (size_t k = 0; k != bucket.size() && fits; k++)
+                {
+                    size_t slot = slotOf(hashes[bucket[k]], (uint32_t)pilot);
+                    fits = ! taken[slot] && find(slots.begin(), slots.end(), slot) == slots.end();
+                    slots.push_back(slot);
+                }
+                if (! fits)
+                    continue;
+                for (size_t k = 0; k != bucket.size(); k++)
+                {
+                    taken[slots[k]] = true;
+                    m_slotPlace[slots[k]] = bucket[k];
+                }
+                m_pilots[order[o]] = (uint32_t)pilot;
+                placed = true;
+            }
+        }
+        if (placed)
+            return;
+    }
+}
+
+bool AttractionMapperImpl::getGeoCoord(const string& attraction, GeoCoord& gc) const
+{
+    if (m_slotPlace.empty())
+        return false;
+    uint64_t h = foldedHash(attraction.data(), attraction.size(), m_hashSeed);
+    size_t place = m_slotPlace[slotOf(h, m_pilots[bucketOf(h)])];
+    size_t start = m_lowerStart[place];
+    if (! foldedEquals(attraction.data(), attraction.size(), m_lowerText.data() + start, m_lowerStart[place + 1] - start))
+        return false;
+    gc = m_places[place].geocoordinates;
+    return true;
+}
+
+// getGeoCoord in stages over a group of names at a time. Each stage prefetches what the next
+// needs (bucket pilot, slot, name), so by the time a name comes round again its memory is
+// likely there, and the misses of the whole group overlap instead of following each other.
+size_t AttractionMapperImpl::getGeoCoords(const string* names, size_t count, GeoCoord* coords, bool* found) const
+{
+    if (m_slotPlace.empty())
+    {
+        fill(found, found + count, false);
+        return 0;
+    }
+    const size_t GROUP = 32;
+    uint64_t hashes[GROUP];
+    size_t places[GROUP];
+    size_t hits = 0;
+    for (size_t lo = 0; lo < count; lo += GROUP)
+    {
+        size_t n = min(GROUP, count - lo);
+        for (size_t i = 0; i != n; i++)
+        {
+            hashes[i] = foldedHash(names[lo + i].data(), names[lo + i].size(), m_hashSeed);
+            PREFETCH(&m_pilots[bucketOf(hashes[i])]);
+        }
+        for (size_t i = 0; i != n; i++)
+        {
+            places[i] = slotOf(hashes[i], m_pilots[bucketOf(hashes[i])]);
+            PREFETCH(&m_slotPlace[places[i]]);
+        }
+        for (size_t i = 0; i != n; i++)
+        {
+            places[i] = m_slotPlace[places[i]];
+            PREFETCH(&m_lowerStart[places[i]]);
+        }
+        for (size_t i = 0; i != n; i++)
+            PREFETCH(m_lowerText.data() + m_lowerStart[places[i]]);
+        for (size_t i = 0; i != n; i++)
+        {
+            size_t place = places[i], start = m_lowerStart[place];
+            const string& name = names[lo + i];
+            found[lo + i] = foldedEquals(name.data(), name.size(), m_lowerText.data() + start, m_lowerStart[place + 1] - start);
+            if (found[lo + i])
+            {
+                coords[lo + i] = m_places[place].geocoordinates;
+                hits++;
+            }
+        }
+    }
+    return hits;
 }
 
 //******************** AttractionMapper functions *****************************
@@ -79,7 +822,42 @@ void AttractionMapper::init(const MapLoader& ml)
     m_impl->init(ml);
 }
 
-bool AttractionMapper::getGeoCoord(string attraction, GeoCoord& gc) const
+void AttractionMapper::addMemoryUsage(MemoryUsage& usage) const
+{
+    m_impl->addMemoryUsage(usage);
+}
+
+vector<Attraction> AttractionMapper::nearestAttractions(const GeoCoord& gc, size_t k) const
+{
+    return m_impl->nearestAttractions(gc, k);
+}
+
+vector<Attraction> AttractionMapper::attractionsWithinRadius(const GeoCoord& gc, double km) const
+{
+    return m_impl->attractionsWithinRadius(gc, km);
+}
+
+vector<Attraction> AttractionMapper::complete(const string& prefix, size_t k) const
+{
+    return m_impl->complete(prefix, k);
+}
+
+bool AttractionMapper::setCompletionWeight(const string& attraction, double weight)
+{
+    return m_impl->setCompletionWeight(attraction, weight);
+}
+
+size_t AttractionMapper::getGeoCoords(const string* names, size_t count, GeoCoord* coords, bool* found) const
+{
+    return m_impl->getGeoCoords(names, count, coords, found);
+}
+
+vector<Attraction> AttractionMapper::fuzzyMatches(const string& name, size_t k, size_t maxEdits) const
+{
+    return m_impl->fuzzyMatches(name, k, maxEdits);
+}
+
+bool AttractionMapper::getGeoCoord(const string& attraction, GeoCoord& gc) const
 {
     return m_impl->getGeoCoord(attraction, gc);
 }
@@ -2,6 +2,8 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include "MyMap.h"
+#include "support.h"
 
 using namespace std;
 
@@ -13,12 +15,34 @@ public:
     bool load(string mapFile);
     size_t getNumSegments() const;
     bool getSegment(size_t segNum, StreetSegment& seg) const;
+    const StreetSegment& getSegmentRef(size_t segNum) const;
+    double getSegmentLength(size_t segNum) const;
+    double getSegmentBearing(size_t segNum, bool reverse) const;
+    size_t getStreetId(size_t segNum) const;
+    const string& getStreetName(size_t streetId) const;
+    size_t getNumStreets() const;
+    void addMemoryUsage(MemoryUsage& usage) const;
 private:
-    vector<StreetSegment> segment;//stl container of somesort
+    MemoryCounter m_segmentMem, m_tableMem, m_streetMem; //before the containers, which count into them
+    
+    TrackedVector<StreetSegment> segment;//stl container of somesort
+    
+    // filled in once the whole file is read, indexed the same as segment
+    TrackedVector<double> m_length;        // miles
+    TrackedVector<double> m_bearing;       // degrees, start to end, as angleOfLine gives
+    TrackedVector<double> m_reverseBearing;// end to start
+    TrackedVector<size_t> m_streetId;
+    
+    TrackedVector<string> m_streetNames;   // indexed by street ID
+    MyMap<string, size_t> m_streetIndex;
+    void computeSegmentTables();
 };
 
 MapLoaderImpl::MapLoaderImpl()
+: segment(&m_segmentMem), m_length(&m_tableMem), m_bearing(&m_tableMem), m_reverseBearing(&m_tableMem),
+  m_streetId(&m_tableMem), m_streetNames(&m_streetMem)
 {
+    m_streetIndex.trackWith(&m_streetMem);
 }
 
 MapLoaderImpl::~MapLoaderImpl()
@@ -29,7 +53,7 @@ MapLoaderImpl::~MapLoaderImpl()
 
 bool MapLoaderImpl::load(string mapFile)
 {
-    
+    TraceScope trace("MapLoader::load");
     ifstream infile(mapFile);    // infile is a name of our choosing
     if ( ! infile )		        // Did opening the file fail?
     {
@@ -37,6 +61,11 @@ bool MapLoaderImpl::load(string mapFile)
         return false;
     }
     
+    segment.clear(); //loading again replaces the previous map
+    m_streetId.clear();
+    m_streetNames.clear();
+    m_streetIndex.clear();
+    
     string streetname, start_lat, start_long, end_lat, end_long;
     int attraction;
     while(true)
@@ -52,14 +81,9 @@ bool MapLoaderImpl::load(string mapFile)
         
         
         
-        GeoCoord* start = new GeoCoord(start_lat, start_long);
-        GeoCoord* end = new GeoCoord(end_lat, end_long);
-        GeoSegment* seg = new GeoSegment(*start, *end);
-        
-        
         StreetSegment welp;
         welp.streetName = streetname;
-        welp.segment = *seg;
+        welp.segment = GeoSegment(GeoCoord(start_lat, start_long), GeoCoord(end_lat, end_long));
         
       
         attraction = stoi(attractions, 0, 10);
@@ -67,7 +91,7 @@ bool MapLoaderImpl::load(string mapFile)
         {
             for (int i =0; i!= attraction; i++)
             {
-                Attraction* someSort = new Attraction;
+                Attraction someSort;
                 string name,lat, log;
                 getline(infile, name, '|'); //this is an attraction;
                 /*for (int a=0; a!=name.size(); a++)
@@ -81,21 +105,50 @@ bool MapLoaderImpl::load(string mapFile)
                 char c;
                 infile.get(c);
                 getline(infile, log, '\n');
-                GeoCoord* attract = new GeoCoord(lat, log);
-                someSort->geocoordinates = *attract;
-                someSort->name = name;
-                welp.attractions.push_back(*someSort);
+                someSort.geocoordinates = GeoCoord(lat, log);
+                someSort.name = name;
+                welp.attractions.push_back(someSort);
             
             }
         }
         
-        segment.push_back(welp);
+        segment.push_back(move(welp));
+        const size_t* id = m_streetIndex.find(streetname);
+        if (id == nullptr)
+        {
+            m_streetIndex.associate(streetname, m_streetNames.size());
+            m_streetId.push_back(m_streetNames.size());
+            m_streetNames.push_back(streetname);
+        }
+        else
+            m_streetId.push_back(*id);
 
     
     }
+    computeSegmentTables();
     return true;  // This compiles, but may not be correct
 }
 
+void MapLoaderImpl::computeSegmentTables()
+{
+    TraceScope trace("MapLoader::computeSegmentTables");
+    size_t n = segment.size();
+    vector<double> lat1(n), lon1(n), lat2(n), lon2(n);
+    for (size_t i = 0; i != n; i++)
+    {
+        lat1[i] = segment[i].segment.start.latitude;
+        lon1[i] = segment[i].segment.start.longitude;
+        lat2[i] = segment[i].segment.end.latitude;
+        lon2[i] = segment[i].segment.end.longitude;
+    }
+    m_length.resize(n);
+    m_bearing.resize(n);
+    m_reverseBearing.resize(n);
+    distanceEarthMilesBatch(lat1.data(), lon1.data(), lat2.data(), lon2.data(), m_length.data(), n);
+    angleOfLineBatch(lat1.data(), lon1.data(), lat2.data(), lon2.data(), m_bearing.data(), n);
+    angleOfLineBatch(lat2.data(), lon2.data(), lat1.data(), lon1.data(), m_reverseBearing.data(), n);
+}
+
 size_t MapLoaderImpl::getNumSegments() const
 {
     return segment.size(); // This compiles, but may not be correct
@@ -103,12 +156,59 @@ size_t MapLoaderImpl::getNumSegments() const
 
 bool MapLoaderImpl::getSegment(size_t segNum, StreetSegment &seg) const
 {
-    if (segNum < 0 ||segNum > getNumSegments()) //keeping the first there anyway
+    if (segNum < 0 ||segNum >= getNumSegments()) //keeping the first there anyway
         return false;
     seg = segment[segNum];
     return true;
 }
 
+// Unchecked: segNum must be less than getNumSegments()
+const StreetSegment& MapLoaderImpl::getSegmentRef(size_t segNum) const
+{
+    return segment[segNum];
+}
+
+double MapLoaderImpl::getSegmentLength(size_t segNum) const
+{
+    return m_length[segNum];
+}
+
+double MapLoaderImpl::getSegmentBearing(size_t segNum, bool reverse) const
+{
+    return reverse ? m_reverseBearing[segNum] : m_bearing[segNum];
+}
+
+size_t MapLoaderImpl::getStreetId(size_t segNum) const
+{
+    return m_streetId[segNum];
+}
+
+const string& MapLoaderImpl::getStreetName(size_t streetId) const
+{
+    return m_streetNames[streetId];
+}
+
+size_t MapLoaderImpl::getNumStreets() const
+{
+    return m_streetNames.size();
+}
+
+void MapLoaderImpl::addMemoryUsage(MemoryUsage& usage) const
+{
+    usage.segments += m_segmentMem.bytes;
+    usage.segmentTables += m_tableMem.bytes;
+    usage.streetNames += m_streetMem.bytes;
+    for (size_t i = 0; i != segment.size(); i++)
+    {
+        usage.segments += heapBytes(segment[i].segment.start) + heapBytes(segment[i].segment.end);
+        usage.streetNames += heapBytes(segment[i].streetName);
+        usage.attractions += heapBytes(segment[i].attractions);
+    }
+    for (size_t i = 0; i != m_streetNames.size(); i++)
+        usage.streetNames += heapBytes(m_streetNames[i]);
+    m_streetIndex.forEach([&usage](const string& name, size_t) { usage.streetNames += heapBytes(name); });
+}
+
 //******************** MapLoader functions ************************************
 
 // These functions simply delegate to MapLoaderImpl's functions.
@@ -129,6 +229,11 @@ bool MapLoader::load(string mapFile)
     return m_impl->load(mapFile);
 }
 
+void MapLoader::addMemoryUsage(MemoryUsage& usage) const
+{
+    m_impl->addMemoryUsage(usage);
+}
+
 size_t MapLoader::getNumSegments() const
 {
     return m_impl->getNumSegments();
@@ -138,6 +243,33 @@ bool MapLoader::getSegment(size_t segNum, StreetSegment& seg) const
 {
     return m_impl->getSegment(segNum, seg);
 }
- 
 
+const StreetSegment& MapLoader::getSegmentRef(size_t segNum) const
+{
+    return m_impl->getSegmentRef(segNum);
+}
+
+double MapLoader::getSegmentLength(size_t segNum) const
+{
+    return m_impl->getSegmentLength(segNum);
+}
+
+double MapLoader::getSegmentBearing(size_t segNum, bool reverse) const
+{
+    return m_impl->getSegmentBearing(segNum, reverse);
+}
+
+size_t MapLoader::getStreetId(size_t segNum) const
+{
+    return m_impl->getStreetId(segNum);
+}
 
+const string& MapLoader::getStreetName(size_t streetId) const
+{
+    return m_impl->getStreetName(streetId);
+}
+
+size_t MapLoader::getNumStreets() const
+{
+    return m_impl->getNumStreets();
+}
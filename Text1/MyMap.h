@@ -3,6 +3,8 @@
 
 #include <map>  // YOU MUST NOT USE THIS HEADER IN CODE YOU TURN IN
 #include "support.h"
+#include <vector>
+#include <utility>
 
 // In accordance with the spec, YOU MUST NOT TURN IN THIS CLASS TEMPLATE,
 // since you are not allowed to use any STL associative containers, and
@@ -24,6 +26,7 @@ public:
     void clear();
     int size() const;
     void associate(const KeyType& key, const ValueType& value);
+    bool erase(const KeyType& key);
     
     // for a map that can't be modified, return a pointer to const ValueType
     const ValueType* find(const KeyType& key) const;
@@ -34,6 +37,16 @@ public:
         return const_cast<ValueType*>(const_cast<const MyMap*>(this)->find(key));
     }
     
+    // Count node allocations, the ones already made included, into counter from now on
+    void trackWith(MemoryCounter* counter);
+    
+    // Longest path from the root, in nodes: log2(size) when balanced, size when keys came in sorted
+    int height() const;
+    
+    // Calls f(key, value) for every entry, smallest key first
+    template<typename F>
+    void forEach(F f) const;
+    
     // C++11 syntax for preventing copying and assignment
     MyMap(const MyMap&) = delete;
     MyMap& operator=(const MyMap&) = delete;
@@ -50,8 +63,11 @@ private:
     
     int m_size;
     Node* m_root;
+    MemoryCounter* m_counter = nullptr;
     
     void freeTree(Node* cur);
+    Node* newNode();
+    void deleteNode(Node* n);
    
    // const ValueType* helpfind(Node* cur, const KeyType& key) const;
     
@@ -82,16 +98,49 @@ int MyMap<KeyType, ValueType>::size() const
 }
 
 
+// Iterative, since a tree built from sorted keys is one long chain and would run recursion
+// out of stack: each node's left subtree is rotated into its right until it has none.
 template<typename KeyType, typename ValueType>
 void MyMap<KeyType, ValueType>::freeTree(Node* cur)
 {
-    if (cur==nullptr)
-        return;
-    freeTree(cur->m_left);
-    freeTree(cur->m_right);
-    delete cur;
-    
-    
+    while (cur != nullptr)
+    {
+        if (cur->m_left != nullptr)
+        {
+            Node* left = cur->m_left;
+            cur->m_left = left->m_right;
+            left->m_right = cur;
+            cur = left;
+        }
+        else
+        {
+            Node* right = cur->m_right;
+            deleteNode(cur);
+            cur = right;
+        }
+    }
+}
+
+template<typename KeyType, typename ValueType>
+int MyMap<KeyType, ValueType>::height() const
+{
+    int best = 0;
+    std::vector<std::pair<const Node*, int> > stack;
+    if (m_root != nullptr)
+        stack.push_back(std::make_pair(m_root, 1));
+    while (! stack.empty())
+    {
+        const Node* cur = stack.back().first;
+        int depth = stack.back().second;
+        stack.pop_back();
+        if (depth > best)
+            best = depth;
+        if (cur->m_left != nullptr)
+            stack.push_back(std::make_pair(cur->m_left, depth + 1));
+        if (cur->m_right != nullptr)
+            stack.push_back(std::make_pair(cur->m_right, depth + 1));
+    }
+    return best;
 }
 
 /*template<typename KeyType, typename ValueType>
@@ -111,11 +160,62 @@ const ValueType* MyMap<KeyType, ValueType>::helpfind(Node* cur, const KeyType& k
 
 
 
+template<typename KeyType, typename ValueType>
+typename MyMap<KeyType, ValueType>::Node* MyMap<KeyType, ValueType>::newNode()
+{
+    if (m_counter != nullptr)
+    {
+        m_counter->bytes += sizeof(Node);
+        m_counter->allocated += sizeof(Node);
+    }
+    return new Node;
+}
+
+template<typename KeyType, typename ValueType>
+void MyMap<KeyType, ValueType>::deleteNode(Node* n)
+{
+    if (m_counter != nullptr)
+        m_counter->bytes -= sizeof(Node);
+    delete n;
+}
+
+template<typename KeyType, typename ValueType>
+void MyMap<KeyType, ValueType>::trackWith(MemoryCounter* counter)
+{
+    if (m_counter != nullptr)
+        m_counter->bytes -= m_size * sizeof(Node);
+    m_counter = counter;
+    if (m_counter != nullptr)
+        m_counter->bytes += m_size * sizeof(Node);
+}
+
+template<typename KeyType, typename ValueType>
+template<typename F>
+void MyMap<KeyType, ValueType>::forEach(F f) const
+{
+    //the tree can be as deep as it is big, so walk it with our own stack rather than recursion
+    std::vector<const Node*> stack;
+    const Node* cur = m_root;
+    while (cur != nullptr || ! stack.empty())
+    {
+        while (cur != nullptr)
+        {
+            stack.push_back(cur);
+            cur = cur->m_left;
+        }
+        cur = stack.back();
+        stack.pop_back();
+        f(cur->m_key, cur->m_value);
+        cur = cur->m_right;
+    }
+}
+
 template<typename KeyType, typename ValueType>
 void MyMap<KeyType, ValueType>::clear()
 {
     freeTree(m_root);
-    
+    m_root = nullptr; //so the map can be reused after clearing
+    m_size = 0;
 }
 
 
@@ -152,7 +252,7 @@ void MyMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& v
     
     if (m_root == nullptr)
     {
-        m_root= new Node;
+        m_root= newNode();
         m_root->m_key = key;
         m_root->m_value= value;
         m_size++;
@@ -173,7 +273,7 @@ void MyMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& v
                 current = current->m_left;
             else
             {
-                current->m_left = new Node;
+                current->m_left = newNode();
                 current->m_left->m_key = key;
                 current->m_left->m_value = value;
                 m_size++;
@@ -186,7 +286,7 @@ void MyMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& v
                 current = current->m_right;
             else
             {
-                current->m_right = new Node;
+                current->m_right = newNode();
                 current->m_right->m_key = key;
                 current->m_right->m_value = value;
                 m_size++;
@@ -200,6 +300,50 @@ void MyMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& v
 
 
 
+template<typename KeyType, typename ValueType>
+bool MyMap<KeyType, ValueType>::erase(const KeyType& key)
+{
+    Node* parent = nullptr;
+    Node* current = m_root;
+    while (current != nullptr && !(key == current->m_key))
+    {
+        parent = current;
+        if (key < current->m_key)
+            current = current->m_left;
+        else
+            current = current->m_right;
+    }
+    if (current == nullptr)
+        return false;
+    
+    if (current->m_left != nullptr && current->m_right != nullptr)
+    {
+        //two children: pull up the smallest key of the right subtree, then remove that node instead
+        Node* succParent = current;
+        Node* succ = current->m_right;
+        while (succ->m_left != nullptr)
+        {
+            succParent = succ;
+            succ = succ->m_left;
+        }
+        current->m_key = succ->m_key;
+        current->m_value = succ->m_value;
+        parent = succParent;
+        current = succ;
+    }
+    
+    Node* child = (current->m_left != nullptr) ? current->m_left : current->m_right;
+    if (parent == nullptr)
+        m_root = child;
+    else if (parent->m_left == current)
+        parent->m_left = child;
+    else
+        parent->m_right = child;
+    deleteNode(current);
+    m_size--;
+    return true;
+}
+
 
 /*template <typename KeyType, typename ValueType>
 class MyMap
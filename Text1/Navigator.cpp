@@ -2,24 +2,490 @@
 #include "support.h"
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <utility>
+#include <atomic>
+#include <thread>
 #include <queue>
+#include <functional>
+#include <cmath>
+#include <memory>
 #include "MyMap.h"
 using namespace std;
 
+const size_t NO_SEGMENT = size_t(-1);
+const uint32_t NO_NODE = uint32_t(-1);
+
+// One step of a route: the coordinate we arrive at, the segment we took to get there, and
+// the step's length and angleOfLine. The first step of a route is the start attraction
+// and has no segment.
+struct RouteStep
+{
+    GeoCoord coord;
+    size_t segId;
+    double distance;
+    double angle;
+};
+
+// Least-recently-used cache of routes keyed by the lowercased (start, end) names. A route is
+// kept as its path (see NavigatorImpl::packRoute), four bytes a step, and rebuilt on a hit.
+// navigate is const and may be called from several threads, so everything is behind m_mutex.
+class RouteCache
+{
+public:
+    RouteCache();
+    void setCapacity(size_t capacity);
+    void clear();
+    // Both add the MyMap probes they make to probes
+    bool lookup(const string& key, NavResult& result, vector<uint32_t>& path, double& cost, size_t& probes);
+    void insert(const string& key, NavResult result, const vector<uint32_t>& path, double cost, size_t& probes);
+    RouteCacheStats stats() const;
+    size_t memoryUsage() const;
+private:
+    struct Entry
+    {
+        string key;
+        NavResult result;
+        TrackedVector<uint32_t> path;
+        double cost;
+    };
+    
+    size_t evictOverflow(); //how many it evicted
+    
+    MemoryCounter m_mem;
+    list<Entry, TrackingAllocator<Entry> > m_entries;  // most recently used at the front
+    MyMap<string, list<Entry, TrackingAllocator<Entry> >::iterator> m_index;
+    size_t m_capacity;
+    size_t m_hits, m_misses, m_evictions;
+    mutable mutex m_mutex;
+};
+
+RouteCache::RouteCache()
+: m_entries(&m_mem), m_capacity(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+    m_index.trackWith(&m_mem);
+}
+
+void RouteCache::setCapacity(size_t capacity)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_capacity = capacity;
+    evictOverflow();
+}
+
+void RouteCache::clear()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_entries.clear();
+    m_index.clear();
+}
+
+bool RouteCache::lookup(const string& key, NavResult& result, vector<uint32_t>& path, double& cost, size_t& probes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_capacity == 0)
+        return false;
+    list<Entry, TrackingAllocator<Entry> >::iterator* it = m_index.find(key);
+    probes++;
+    if (it == nullptr)
+    {
+        m_misses++;
+        return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, *it); //iterators stay valid across splice
+    result = (*it)->result;
+    path.assign((*it)->path.begin(), (*it)->path.end());
+    cost = (*it)->cost;
+    m_hits++;
+    return true;
+}
+
+void RouteCache::insert(const string& key, NavResult result, const vector<uint32_t>& path, double cost, size_t& probes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_capacity == 0)
+        return;
+    list<Entry, TrackingAllocator<Entry> >::iterator* it = m_index.find(key);
+    probes++;
+    if (it != nullptr) //another thread got here first
+    {
+        m_entries.splice(m_entries.begin(), m_entries, *it);
+        return;
+    }
+    m_entries.push_front(Entry());
+    Entry& e = m_entries.front();
+    e.key = key;
+    e.result = result;
+    e.path = TrackedVector<uint32_t>(path.begin(), path.end(), &m_mem);
+    e.cost = cost;
+    m_index.associate(key, m_entries.begin());
+    probes += 1 + evictOverflow();
+}
+
+RouteCacheStats RouteCache::stats() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    RouteCacheStats s;
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.evictions = m_evictions;
+    s.size = m_entries.size();
+    s.capacity = m_capacity;
+    return s;
+}
+
+size_t RouteCache::memoryUsage() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    size_t bytes = m_mem.bytes;
+    for (list<Entry, TrackingAllocator<Entry> >::const_iterator it = m_entries.begin(); it != m_entries.end(); it++)
+        bytes += 2 * heapBytes(it->key); //the index holds a copy of the key too
+    return bytes;
+}
+
+size_t RouteCache::evictOverflow()
+{
+    size_t evicted = 0;
+    while (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+        m_evictions++;
+        evicted++;
+    }
+    return evicted;
+}
+
+// What a search has to keep an eye on besides the map
+struct SearchLimits
+{
+    SearchLimits()
+    : deadline(NavDeadline::max()), cancel(nullptr)
+    {}
+    
+    NavDeadline deadline;
+    const CancelToken* cancel;
+    
+    // Reading the clock every expansion would cost more than the expansion, so only check every so often
+    static const int CHECK_EVERY = 256;
+    
+    NavResult check() const
+    {
+        if (cancel != nullptr && cancel->cancelled())
+            return NAV_CANCELLED;
+        if (deadline != NavDeadline::max() && chrono::steady_clock::now() >= deadline)
+            return NAV_TIMEOUT;
+        return NAV_SUCCESS;
+    }
+};
+
+struct SearchScratch;
+struct node;
+
+// Per-query stats. t_collecting points at the NavStats the query on this thread is filling
+// in, or is null, which is all the search itself ever checks.
+namespace {
+
+atomic<bool> g_statsEnabled(false);
+thread_local NavStats t_lastStats;
+thread_local NavStats* t_collecting = nullptr;
+
+struct StatsTotals
+{
+    atomic<size_t> queries, cacheHits;
+    atomic<size_t> totalMicros[NavStatsSummary::BUCKETS], nodesExpanded[NavStatsSummary::BUCKETS];
+    
+    StatsTotals()
+    {
+        reset();
+    }
+    
+    void reset()
+    {
+        queries = 0;
+        cacheHits = 0;
+        for (int i = 0; i != NavStatsSummary::BUCKETS; i++)
+        {
+            totalMicros[i] = 0;
+            nodesExpanded[i] = 0;
+        }
+    }
+};
+
+StatsTotals g_statsTotals;
+
+int histogramBucket(double value)
+{
+    int bucket = 0;
+    while (value >= 1 && bucket != NavStatsSummary::BUCKETS - 1)
+    {
+        value /= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+double microsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// Times its scope into *out, if there is an out
+class PhaseTimer
+{
+public:
+    PhaseTimer(double* out)
+    : m_out(out)
+    {
+        if (m_out != nullptr)
+            m_start = chrono::steady_clock::now();
+    }
+    ~PhaseTimer()
+    {
+        if (m_out != nullptr)
+            *m_out += microsSince(m_start);
+    }
+private:
+    double* m_out;
+    chrono::steady_clock::time_point m_start;
+};
+
+// Lives for one query: starts collecting if anyone wants the stats, then files them
+class QueryStats
+{
+public:
+    QueryStats(NavStats* out = nullptr)
+    : m_out(out), m_active(out != nullptr || g_statsEnabled.load(memory_order_relaxed))
+    {
+        if (! m_active)
+            return;
+        t_lastStats = NavStats();
+        t_collecting = &t_lastStats;
+        m_start = chrono::steady_clock::now();
+    }
+    ~QueryStats()
+    {
+        if (! m_active)
+            return;
+        t_collecting = nullptr;
+        t_lastStats.totalMicros = microsSince(m_start);
+        g_statsTotals.queries++;
+        if (t_lastStats.cacheHit)
+            g_statsTotals.cacheHits++;
+        g_statsTotals.totalMicros[histogramBucket(t_lastStats.totalMicros)]++;
+        g_statsTotals.nodesExpanded[histogramBucket(t_lastStats.nodesExpanded)]++;
+        if (m_out != nullptr)
+            *m_out = t_lastStats;
+    }
+private:
+    NavStats* m_out;
+    bool m_active;
+    chrono::steady_clock::time_point m_start;
+};
+
+// The search's counters. They're plain locals so counting costs next to nothing; they're
+// added into the query's NavStats, if it has one, when the search finishes.
+struct SearchCounters
+{
+    size_t expanded = 0, relaxed = 0, pushes = 0, pops = 0, peakHeap = 0, probes = 0, bytes = 0;
+    NavStats* out;
+    chrono::steady_clock::time_point start;
+    bool searching = true;
+    
+    SearchCounters(NavStats* stats)
+    : out(stats)
+    {
+        if (out != nullptr)
+            start = chrono::steady_clock::now();
+    }
+    
+    void searchDone()
+    {
+        if (out != nullptr && searching)
+            out->searchMicros += microsSince(start);
+        searching = false;
+    }
+    
+    ~SearchCounters()
+    {
+        searchDone(); //if we gave up early
+        if (out == nullptr)
+            return;
+        out->nodesExpanded += expanded;
+        out->edgesRelaxed += relaxed;
+        out->heapPushes += pushes;
+        out->heapPops += pops;
+        out->peakHeap = max(out->peakHeap, peakHeap);
+        out->mapProbes += probes;
+        out->bytesAllocated += bytes;
+    }
+};
+
+// push_back, counting anything the route had to allocate to take the step
+void pushStep(vector<RouteStep>& route, const RouteStep& step, size_t& bytes)
+{
+    size_t capacity = route.capacity();
+    route.push_back(step);
+    if (route.capacity() != capacity)
+        bytes += route.capacity() * sizeof(RouteStep);
+    bytes += heapBytes(step.coord);
+}
+
+} // namespace
+
+// Landmarks for the ALT heuristic: network miles from each of a few far-apart nodes to
+// every node. By the triangle inequality |d(L,t) - d(L,v)| can't be more than d(v,t).
+struct Landmarks
+{
+    static const size_t COUNT = 4;
+    MyMap<GeoCoord, size_t> index; //row of each node in dist
+    TrackedVector<double> dist; //COUNT per node; infinity where a landmark can't reach
+    
+    Landmarks(MemoryCounter* mem)
+    : dist(mem)
+    {
+        index.trackWith(mem);
+    }
+    
+    void clear()
+    {
+        index.clear();
+        dist.clear();
+        dist.shrink_to_fit();
+    }
+};
+
+// Segments closed or slowed down on top of the map (see Navigator::updateClosures). One is
+// never changed once queries can see it: an update builds a new one and swaps the pointer,
+// so a query holding one sees the same closures from start to finish.
+struct ClosureOverlay
+{
+    vector<uint64_t> closed; //one bit per segment
+    vector<float> factor;    //per segment; left empty while nothing open costs more than its length
+    size_t numClosed = 0, numSlowed = 0;
+    size_t version = 0;      //one more each update, for telling cached routes apart
+    
+    bool active() const
+    {
+        return numClosed != 0 || numSlowed != 0;
+    }
+    bool isClosed(size_t segId) const
+    {
+        return (closed[segId >> 6] >> (segId & 63)) & 1;
+    }
+    double costFactor(size_t segId) const
+    {
+        return factor.empty() ? 1 : factor[segId];
+    }
+};
+
+// Turn costs as queries see them; replaced whole by setTurnCosts, as the closure overlay is
+struct TurnSettings
+{
+    TurnCosts costs;
+    size_t version = 0;
+    
+    bool active() const
+    {
+        return costs.left != 0 || costs.right != 0 || costs.uTurn != 0;
+    }
+};
+
+// How a move from one segment onto another at a shared end looks to the driver
+enum TurnClass
+{
+    TURN_STRAIGHT, TURN_LEFT, TURN_RIGHT, TURN_UTURN
+};
+
 class NavigatorImpl
 {
 public:
     NavigatorImpl();
     ~NavigatorImpl();
     bool loadMapData(string mapFile);
-    NavResult navigate(string start, string end, vector<NavSegment>& directions) const;
+    NavResult navigate(string start, string end, vector<NavSegment>& directions, const SearchLimits& limits,
+                       NavStats* stats = nullptr) const;
+    NavResult navigateSteps(string start, string end, const NavStepSink& sink, const SearchLimits& limits) const;
+    NavResult navigatePolyline(string start, string end, string& polyline, int precision) const;
+    const string& getStreetName(size_t streetId) const;
+    NavResult reachable(string start, double maxDistance, Reachability& result, const SearchLimits& limits) const;
+    NavResult alternatives(string start, string end, size_t k, vector<NavRoute>& routes, double maxStretch, double maxOverlap,
+                           const SearchLimits& limits) const;
+    void setRouteCacheCapacity(size_t capacity);
+    RouteCacheStats getRouteCacheStats() const;
+    void setTurnCosts(const TurnCosts& costs);
+    bool updateClosures(const vector<SegmentCostChange>& changes);
+    void clearClosures();
+    double getSegmentCostFactor(size_t segId) const;
+    size_t getNumComponents() const;
+    vector<ComponentInfo> getComponentStats() const;
+    MemoryUsage memoryUsage() const;
+    vector<Attraction> suggestAttractions(string name, size_t k, size_t maxEdits) const;
 private:
+    MemoryCounter m_turnMem, m_componentMem, m_landmarkMem; //before the containers, which count into them
     MapLoader ml;
     AttractionMapper am;
     SegmentMapper sm;
+    mutable RouteCache m_cache;
     
+    // Turn tables, flat. Segment end 2 * segId is the segment's start and 2 * segId + 1 its
+    // end; a coordinate where ends meet is a node. The ways out of a node are its exits, each
+    // leading to another segment end, and each end arriving at the node has a row of
+    // TurnClass bytes there, one per exit.
+    TrackedVector<uint32_t> m_endNode;      // per segment end
+    TrackedVector<uint32_t> m_endRow;       // per segment end: its row at its node
+    TrackedVector<uint32_t> m_exitFirst;    // per node, and one past the last: where its exits start
+    TrackedVector<uint32_t> m_exitTo;       // per exit: the segment end it arrives at
+    TrackedVector<double> m_exitMiles;      // per exit
+    TrackedVector<uint32_t> m_turnFirst;    // per node: where its rows start in m_turnClass
+    TrackedVector<unsigned char> m_turnClass;
     
-
+    void buildTurnTable();
+    const GeoCoord& endCoord(uint32_t end) const;
+    uint32_t nodeAt(const GeoCoord& gc, const vector<size_t>& segs) const;
+    
+    TrackedVector<size_t> m_component; //component number of each segment
+    TrackedVector<ComponentInfo> m_componentInfo;
+    void labelComponents();
+    bool sameComponent(const GeoCoord& a, const GeoCoord& b) const;
+    
+    Landmarks m_landmarks; //only built if the build's heuristic uses them
+    TrackedVector<double> m_segmentSpeed; //mph, only built if the build's metric is time
+    void buildLandmarks();
+    void buildSegmentSpeeds();
+    
+    // Queries atomic_load the current overlay and turn costs, so changing them never waits
+    // for queries; m_updateMutex only keeps two updates from building on the same old one.
+    shared_ptr<const ClosureOverlay> m_closures; //null until the first update
+    shared_ptr<const TurnSettings> m_turns;      //null until the first setTurnCosts
+    mutex m_updateMutex;
+    shared_ptr<const ClosureOverlay> closures() const;
+    
+    NavResult route(const string& start, const string& end, vector<RouteStep>& route, const SearchLimits& limits) const;
+    template<class Policy>
+    NavResult findRoute(const GeoCoord& sgc, const GeoCoord& egc, vector<RouteStep>& route, const SearchLimits& limits,
+                        const ClosureOverlay* closures, const TurnCosts* turns, double& cost) const;
+    template<class Policy>
+    NavResult findTurnRoute(const GeoCoord& sgc, const GeoCoord& egc, vector<RouteStep>& route, const SearchLimits& limits,
+                            const ClosureOverlay* closures, const TurnCosts& turns, double& cost) const;
+    void expand(const GeoCoord& cur, const GeoCoord& target, const vector<size_t>& targetSegs, bool allAttractions,
+                SearchScratch& scratch) const;
+    RouteStep makeStep(const GeoCoord& from, const GeoCoord& to, size_t segId, double distance) const;
+    void packRoute(const vector<RouteStep>& route, vector<uint32_t>& path) const;
+    void unpackRoute(const vector<uint32_t>& path, const GeoCoord& sgc, const GeoCoord& egc, vector<RouteStep>& route) const;
+    template<typename F> void walkSteps(const vector<RouteStep>& route, F f) const;
+    void buildDirections(const vector<RouteStep>& route, vector<NavSegment>& directions) const;
+    struct ShortestPathTree;
+    NavResult growTree(const GeoCoord& root, const GeoCoord& target, const vector<size_t>& midSegs, const GeoCoord& mid,
+                       double maxStretch, const ClosureOverlay* closures, const SearchLimits& limits,
+                       ShortestPathTree& tree, double& targetDist) const;
+    
+    friend class RerouteSessionImpl;
 };
 
 struct node
@@ -27,13 +493,16 @@ struct node
     node();
     node* parent = nullptr;
     GeoCoord coord;
-    StreetSegment seg;
-    float g, h;
+    size_t segId; //segment we took to reach coord
+    double step; //length of that last step, which g also counts turn costs on top of
+    double g, h;
 };
 
 
 node::node()
 {
+    segId = NO_SEGMENT;
+    step = 0;
     g =0;
     h =0;
 }
@@ -42,8 +511,8 @@ node::node()
 
 bool operator<(const node& a, const node& b)
 {
-    float af = a.g+ a.h;
-    float bf = b.g+ b.h;
+    double af = a.g+ a.h;
+    double bf = b.g+ b.h;
     
     if (af > bf)
         return true;
@@ -51,28 +520,1580 @@ bool operator<(const node& a, const node& b)
 
 }
 
-NavigatorImpl::NavigatorImpl()
+// priority_queue<node*> would order by address, so compare what the pointers point to
+struct nodeCompare
 {
-    
+    bool operator()(const node* a, const node* b) const
+    {
+        return *a < *b;
+    }
+};
 
+// A segment end on findTurnRoute's open list: f = g + h, and g as it was when pushed, so
+// entries left behind by a cheaper way in can be told apart
+struct TurnEntry
+{
+    double f, g;
+    uint32_t end;
+};
 
-}
+struct turnEntryCompare
+{
+    bool operator()(const TurnEntry& a, const TurnEntry& b) const
+    {
+        return a.f > b.f;
+    }
+};
 
-NavigatorImpl::~NavigatorImpl()
+// Buffers reused from one search to the next. There is one per thread, so concurrent
+// navigate calls on a shared Navigator each search with their own warm buffers.
+struct SearchScratch
+{
+    MemoryCounter mem; //everything below allocates through it, so a query can tell what it took
+    deque<node, TrackingAllocator<node> > nodes; //deque so node pointers stay valid as it grows
+    size_t used = 0;
+    TrackedVector<node*> open; //binary heap ordered by nodeCompare
+    MyMap<GeoCoord, double> bestG;
+    
+    // findTurnRoute's state per segment end and per node, stamped with the search it's from
+    // so nothing needs clearing in between
+    TrackedVector<double> endG, nodeH;
+    TrackedVector<uint32_t> endParent, endStamp, nodeStamp;
+    uint32_t stamp = 0;
+    TrackedVector<TurnEntry> turnOpen; //heap ordered by turnEntryCompare
+    TrackedVector<uint32_t> unestimated; //nodes waiting on a batch of heuristics
+    
+    // the neighbours of the node being expanded (see NavigatorImpl::expand)
+    TrackedVector<GeoCoord> next;
+    TrackedVector<size_t> nextSeg;
+    TrackedVector<double> nextCost;
+    // laid out for the batch distance kernel
+    TrackedVector<double> lat1, lon1, lat2, lon2, dist;
+    
+    SearchScratch()
+    : nodes(&mem), open(&mem), endG(&mem), nodeH(&mem), endParent(&mem), endStamp(&mem), nodeStamp(&mem),
+      turnOpen(&mem), unestimated(&mem), next(&mem), nextSeg(&mem), nextCost(&mem),
+      lat1(&mem), lon1(&mem), lat2(&mem), lon2(&mem), dist(&mem)
+    {
+        bestG.trackWith(&mem);
+    }
+    
+    void reset()
+    {
+        used = 0;
+        open.clear();
+        bestG.clear();
+    }
+    
+    void startTurnSearch(size_t ends, size_t nodes)
+    {
+        if (endStamp.size() < ends)
+        {
+            endG.resize(ends);
+            endParent.resize(ends);
+            endStamp.resize(ends, 0);
+        }
+        if (nodeStamp.size() < nodes)
+        {
+            nodeH.resize(nodes);
+            nodeStamp.resize(nodes, 0);
+        }
+        if (++stamp == 0) //wrapped; anything still stamped could look current
+        {
+            fill(endStamp.begin(), endStamp.end(), 0);
+            fill(nodeStamp.begin(), nodeStamp.end(), 0);
+            stamp = 1;
+        }
+        turnOpen.clear();
+    }
+    
+    node* newNode()
+    {
+        if (used == nodes.size())
+            nodes.emplace_back();
+        node* n = &nodes[used++];
+        *n = node();
+        return n;
+    }
+};
+
+static SearchScratch& searchScratch()
 {
+    static thread_local SearchScratch scratch;
+    return scratch;
 }
 
-bool NavigatorImpl::loadMapData(string mapFile)
+// The choices findRoute makes are template parameters, so each combination is its own
+// fully inlined search with no virtual calls. The build picks one (see BuildRoute below).
+//
+// Heuristic: fills scratch.dist[0..m) with a lower bound, in miles, on the distance from
+// each of scratch.next[0..m) to the target.
+struct HaversineHeuristic
 {
-    if (ml.load(mapFile)== false)
-        return false;
-    am.init(ml);
-    sm.init(ml);
-    return true;  // This compiles, but may not be correct
+    static const bool USES_LANDMARKS = false;
+    static void estimate(const Landmarks&, const double*, const GeoCoord& target, SearchScratch& scratch, size_t m)
+    {
+        const TrackedVector<GeoCoord>& next = scratch.next;
+        scratch.lat1.resize(m);
+        scratch.lon1.resize(m);
+        scratch.lat2.assign(m, target.latitude);
+        scratch.lon2.assign(m, target.longitude);
+        scratch.dist.resize(m);
+        for (size_t j = 0; j != m; j++)
+        {
+            scratch.lat1[j] = next[j].latitude;
+            scratch.lon1[j] = next[j].longitude;
+        }
+        distanceEarthMilesBatch(scratch.lat1.data(), scratch.lon1.data(), scratch.lat2.data(), scratch.lon2.data(),
+                                scratch.dist.data(), m);
+    }
+};
+
+// Flat-earth distance with the longitude squeezed by cos(target latitude): no trig per point.
+// Over a city it's within a fraction of a percent of haversine; the 0.99 keeps it underneath.
+struct EquirectangularHeuristic
+{
+    static const bool USES_LANDMARKS = false;
+    static void estimate(const Landmarks&, const double*, const GeoCoord& target, SearchScratch& scratch, size_t m)
+    {
+        const double MILES_PER_DEGREE = 0.99 * 3958.8 * 3.14159265358979323846 / 180;
+        double squeeze = cos(target.latitude * 3.14159265358979323846 / 180);
+        scratch.dist.resize(m);
+        for (size_t j = 0; j != m; j++)
+        {
+            double dy = scratch.next[j].latitude - target.latitude;
+            double dx = (scratch.next[j].longitude - target.longitude) * squeeze;
+            scratch.dist[j] = MILES_PER_DEGREE * sqrt(dx * dx + dy * dy);
+        }
+    }
+};
+
+// Plain Dijkstra
+struct ZeroHeuristic
+{
+    static const bool USES_LANDMARKS = false;
+    static void estimate(const Landmarks&, const double*, const GeoCoord&, SearchScratch& scratch, size_t m)
+    {
+        scratch.dist.assign(m, 0);
+    }
+};
+
+// ALT: the best of haversine and the landmark bounds. targetDist is the target's row in
+// landmarks.dist, or null if the target isn't a node there.
+struct LandmarkHeuristic
+{
+    static const bool USES_LANDMARKS = true;
+    static void estimate(const Landmarks& landmarks, const double* targetDist, const GeoCoord& target,
+                         SearchScratch& scratch, size_t m)
+    {
+        HaversineHeuristic::estimate(landmarks, targetDist, target, scratch, m);
+        if (targetDist == nullptr)
+            return;
+        for (size_t j = 0; j != m; j++)
+        {
+            const size_t* row = landmarks.index.find(scratch.next[j]);
+            if (row == nullptr)
+                continue;
+            const double* d = &landmarks.dist[*row * Landmarks::COUNT];
+            for (size_t l = 0; l != Landmarks::COUNT; l++)
+            {
+                if (d[l] == HUGE_VAL || targetDist[l] == HUGE_VAL)
+                    continue;
+                double bound = fabs(targetDist[l] - d[l]);
+                if (bound > scratch.dist[j])
+                    scratch.dist[j] = bound;
+            }
+        }
+    }
+};
+
+// Units: what one mile of cost is worth
+struct Miles
+{
+    static constexpr double PER_MILE = 1;
+};
+
+struct Kilometers
+{
+    static constexpr double PER_MILE = 1.609344;
+};
+
+// Metric: what the search minimises. cost turns miles driven on a segment into cost,
+// bound turns a lower bound on miles left into a lower bound on cost, and reported turns
+// a route's cost into the unit NavStats::routeCost is given in.
+struct DistanceMetric
+{
+    static const bool USES_SPEED = false;
+    static const char* unit()
+    {
+        return "miles";
+    }
+    template<class Units>
+    static double reported(double cost)
+    {
+        return cost / Units::PER_MILE;
+    }
+    template<class Units>
+    static double cost(double miles, size_t, const TrackedVector<double>&)
+    {
+        return miles * Units::PER_MILE;
+    }
+    template<class Units>
+    static double bound(double miles)
+    {
+        return miles * Units::PER_MILE;
+    }
+};
+
+// Driving time in hours at the speed guessed for each street from its name
+struct TimeMetric
+{
+    static const bool USES_SPEED = true;
+    static constexpr double MAX_MPH = 50; //the fastest speed buildSegmentSpeeds hands out
+    static const char* unit()
+    {
+        return "hours";
+    }
+    template<class Units>
+    static double reported(double cost) //hours whatever the units
+    {
+        return cost;
+    }
+    template<class Units>
+    static double cost(double miles, size_t segId, const TrackedVector<double>& speed)
+    {
+        return miles / speed[segId];
+    }
+    template<class Units>
+    static double bound(double miles)
+    {
+        return miles / MAX_MPH;
+    }
+};
+
+// Heap: the open list, over scratch.open, ordered by nodeCompare
+struct BinaryHeap
+{
+    static void push(TrackedVector<node*>& heap, node* n)
+    {
+        heap.push_back(n);
+        push_heap(heap.begin(), heap.end(), nodeCompare());
+    }
+    static node* pop(TrackedVector<node*>& heap)
+    {
+        pop_heap(heap.begin(), heap.end(), nodeCompare());
+        node* top = heap.back();
+        heap.pop_back();
+        return top;
+    }
+};
+
+// Four children per parent: a shallower tree, and the children share a cache line
+struct QuaternaryHeap
+{
+    static void push(TrackedVector<node*>& heap, node* n)
+    {
+        size_t i = heap.size();
+        heap.push_back(n);
+        while (i > 0)
+        {
+            size_t parent = (i - 1) / 4;
+            if (! nodeCompare()(heap[parent], n))
+                break;
+            heap[i] = heap[parent];
+            i = parent;
+        }
+        heap[i] = n;
+    }
+    static node* pop(TrackedVector<node*>& heap)
+    {
+        node* top = heap[0];
+        node* last = heap.back();
+        heap.pop_back();
+        size_t size = heap.size();
+        if (size == 0)
+            return top;
+        size_t i = 0;
+        for (;;)
+        {
+            size_t child = 4 * i + 1;
+            if (child >= size)
+                break;
+            size_t best = child;
+            size_t stop = min(child + 4, size);
+            for (size_t c = child + 1; c < stop; c++)
+                if (nodeCompare()(heap[best], heap[c]))
+                    best = c;
+            if (! nodeCompare()(last, heap[best]))
+                break;
+            heap[i] = heap[best];
+            i = best;
+        }
+        heap[i] = last;
+        return top;
+    }
+};
+
+template<class H, class M, class Q, class U>
+struct RoutePolicy
+{
+    typedef H Heuristic;
+    typedef M Metric;
+    typedef Q Heap;
+    typedef U Units;
+};
+
+// The search navigate uses. Override at build time, e.g.
+//   g++ -DNAV_HEURISTIC=LandmarkHeuristic -DNAV_HEAP=QuaternaryHeap ...
+#ifndef NAV_HEURISTIC
+#define NAV_HEURISTIC HaversineHeuristic
+#endif
+#ifndef NAV_METRIC
+#define NAV_METRIC DistanceMetric
+#endif
+#ifndef NAV_HEAP
+#define NAV_HEAP BinaryHeap
+#endif
+#ifndef NAV_UNITS
+#define NAV_UNITS Miles
+#endif
+typedef RoutePolicy<NAV_HEURISTIC, NAV_METRIC, NAV_HEAP, NAV_UNITS> BuildRoute;
+
+NavigatorImpl::NavigatorImpl()
+: m_endNode(&m_turnMem), m_endRow(&m_turnMem), m_exitFirst(&m_turnMem), m_exitTo(&m_turnMem),
+  m_exitMiles(&m_turnMem), m_turnFirst(&m_turnMem), m_turnClass(&m_turnMem),
+  m_component(&m_componentMem), m_componentInfo(&m_componentMem), m_landmarks(&m_landmarkMem),
+  m_segmentSpeed(&m_landmarkMem)
+{
+}
+
+NavigatorImpl::~NavigatorImpl()
+{
+}
+
+bool NavigatorImpl::loadMapData(string mapFile)
+{
+    TraceScope trace("Navigator::loadMapData");
+    m_cache.clear(); //cached routes belong to the old map
+    atomic_store(&m_closures, shared_ptr<const ClosureOverlay>()); //and so do segment IDs
+    if (ml.load(mapFile)== false)
+        return false;
+    am.init(ml);
+    sm.init(ml);
+    buildTurnTable();
+    labelComponents();
+    m_landmarks.clear();
+    m_segmentSpeed.clear();
+    m_segmentSpeed.shrink_to_fit();
+    if (BuildRoute::Heuristic::USES_LANDMARKS)
+        buildLandmarks();
+    if (BuildRoute::Metric::USES_SPEED)
+        buildSegmentSpeeds();
+    return true;  // This compiles, but may not be correct
+}
+
+void NavigatorImpl::buildTurnTable()
+{
+    TraceScope trace("Navigator::buildTurnTable");
+    size_t n = ml.getNumSegments();
+    m_endNode.assign(2 * n, 0);
+    m_endRow.assign(2 * n, 0);
+    m_exitFirst.clear();
+    m_exitTo.clear();
+    m_exitMiles.clear();
+    m_turnFirst.clear();
+    m_turnClass.clear();
+    
+    MyMap<GeoCoord, uint32_t> nodeOf;
+    vector<uint32_t> someEnd; //one end at each node, for its coordinate
+    for (uint32_t end = 0; end != 2 * n; end++)
+    {
+        const uint32_t* node = nodeOf.find(endCoord(end));
+        if (node != nullptr)
+        {
+            m_endNode[end] = *node;
+            continue;
+        }
+        m_endNode[end] = uint32_t(someEnd.size());
+        nodeOf.associate(endCoord(end), m_endNode[end]);
+        someEnd.push_back(end);
+    }
+    
+    vector<double> exitAngle; //heading as we leave; NAN partway along, where there's no turning
+    vector<size_t> exitSeg;
+    for (size_t v = 0; v != someEnd.size(); v++)
+    {
+        const GeoCoord& at = endCoord(someEnd[v]);
+        const vector<size_t>& ids = sm.getSegmentIds(at);
+        m_exitFirst.push_back(uint32_t(m_exitTo.size()));
+        m_turnFirst.push_back(uint32_t(m_turnClass.size()));
+        exitAngle.clear();
+        exitSeg.clear();
+        for (size_t i = 0; i != ids.size(); i++)
+        {
+            const GeoSegment& gs = ml.getSegmentRef(ids[i]).segment;
+            bool atStart = at == gs.start;
+            bool atEnd = at == gs.end;
+            if (! atStart) //an attraction's segment passing by goes both ways
+            {
+                m_exitTo.push_back(uint32_t(2 * ids[i]));
+                m_exitMiles.push_back(atEnd ? ml.getSegmentLength(ids[i]) : distanceEarthMiles(at, gs.start));
+                exitAngle.push_back(atEnd ? ml.getSegmentBearing(ids[i], true) : NAN);
+                exitSeg.push_back(ids[i]);
+            }
+            if (! atEnd)
+            {
+                m_exitTo.push_back(uint32_t(2 * ids[i] + 1));
+                m_exitMiles.push_back(atStart ? ml.getSegmentLength(ids[i]) : distanceEarthMiles(at, gs.end));
+                exitAngle.push_back(atStart ? ml.getSegmentBearing(ids[i], false) : NAN);
+                exitSeg.push_back(ids[i]);
+            }
+        }
+        
+        uint32_t row = 0;
+        for (size_t i = 0; i != ids.size(); i++)
+        {
+            const GeoSegment& gs = ml.getSegmentRef(ids[i]).segment;
+            for (int e = 0; e != 2; e++)
+            {
+                if (! (at == (e == 0 ? gs.start : gs.end)))
+                    continue;
+                m_endRow[2 * ids[i] + e] = row++;
+                double inAngle = ml.getSegmentBearing(ids[i], e == 0); //heading as we arrive
+                for (size_t x = 0; x != exitSeg.size(); x++)
+                {
+                    double turn = exitAngle[x] - inAngle;
+                    if (turn < 0)
+                        turn += 360;
+                    unsigned char c;
+                    if (exitAngle[x] != exitAngle[x]) //NAN
+                        c = TURN_STRAIGHT;
+                    else if (exitSeg[x] == ids[i] || (turn > 165 && turn < 195))
+                        c = TURN_UTURN;
+                    else if (turn < 30 || turn > 330)
+                        c = TURN_STRAIGHT;
+                    else if (turn < 180) //as dirTurn would put it
+                        c = TURN_LEFT;
+                    else
+                        c = TURN_RIGHT;
+                    m_turnClass.push_back(c);
+                }
+            }
+        }
+    }
+    m_exitFirst.push_back(uint32_t(m_exitTo.size()));
+}
+
+const GeoCoord& NavigatorImpl::endCoord(uint32_t end) const
+{
+    const GeoSegment& gs = ml.getSegmentRef(end >> 1).segment;
+    return (end & 1) != 0 ? gs.end : gs.start;
+}
+
+// The node at gc, given the segments there; NO_NODE if gc is only partway along them
+uint32_t NavigatorImpl::nodeAt(const GeoCoord& gc, const vector<size_t>& segs) const
+{
+    for (size_t i = 0; i != segs.size(); i++)
+    {
+        const GeoSegment& gs = ml.getSegmentRef(segs[i]).segment;
+        if (gc == gs.start)
+            return m_endNode[2 * segs[i]];
+        if (gc == gs.end)
+            return m_endNode[2 * segs[i] + 1];
+    }
+    return NO_NODE;
+}
+
+// Union-find over segment IDs: segments that share any coordinate are in one component.
+// Roots are only ever linked under a smaller ID, and each link is a compare-and-swap on a
+// root, so the segments can be split across threads with no locking; find halves paths as
+// it goes. Afterwards the roots are renumbered 0, 1, 2, ... in order of first segment.
+namespace {
+
+size_t ufFind(vector<atomic<size_t> >& parent, size_t x)
+{
+    for (;;)
+    {
+        size_t p = parent[x].load();
+        if (p == x)
+            return x;
+        size_t gp = parent[p].load();
+        if (p != gp)
+            parent[x].compare_exchange_weak(p, gp); //fine if it fails; someone else shortened it
+        x = gp;
+    }
+}
+
+void ufUnite(vector<atomic<size_t> >& parent, size_t a, size_t b)
+{
+    for (;;)
+    {
+        a = ufFind(parent, a);
+        b = ufFind(parent, b);
+        if (a == b)
+            return;
+        if (a < b)
+            swap(a, b);
+        size_t expected = a;
+        if (parent[a].compare_exchange_strong(expected, b))
+            return;
+        //a stopped being a root under us; go round again
+    }
+}
+
+} // namespace
+
+void NavigatorImpl::labelComponents()
+{
+    TraceScope trace("Navigator::labelComponents");
+    size_t n = ml.getNumSegments();
+    vector<atomic<size_t> > parent(n);
+    for (size_t i = 0; i != n; i++)
+        parent[i].store(i);
+    
+    auto uniteRange = [this, &parent](size_t from, size_t to) {
+        for (size_t s = from; s != to; s++)
+        {
+            const StreetSegment& seg = ml.getSegmentRef(s);
+            const vector<size_t>& atStart = sm.getSegmentIds(seg.segment.start);
+            for (size_t j = 0; j != atStart.size(); j++)
+                ufUnite(parent, s, atStart[j]);
+            const vector<size_t>& atEnd = sm.getSegmentIds(seg.segment.end);
+            for (size_t j = 0; j != atEnd.size(); j++)
+                ufUnite(parent, s, atEnd[j]);
+            for (size_t a = 0; a != seg.attractions.size(); a++) //an attraction can sit on a corner
+            {
+                const vector<size_t>& atAttraction = sm.getSegmentIds(seg.attractions[a].geocoordinates);
+                for (size_t j = 0; j != atAttraction.size(); j++)
+                    ufUnite(parent, s, atAttraction[j]);
+            }
+        }
+    };
+    
+    size_t numThreads = thread::hardware_concurrency();
+    const size_t MIN_PER_THREAD = 1 << 14; //below this, starting threads costs more than it saves
+    if (numThreads > n / MIN_PER_THREAD)
+        numThreads = n / MIN_PER_THREAD;
+    if (numThreads <= 1)
+        uniteRange(0, n);
+    else
+    {
+        vector<thread> workers;
+        for (size_t t = 0; t != numThreads; t++)
+            workers.push_back(thread(uniteRange, n * t / numThreads, n * (t + 1) / numThreads));
+        for (size_t t = 0; t != numThreads; t++)
+            workers[t].join();
+    }
+    
+    m_component.assign(n, 0);
+    m_componentInfo.clear();
+    vector<size_t> label(n, NO_SEGMENT);
+    for (size_t s = 0; s != n; s++)
+    {
+        size_t root = ufFind(parent, s);
+        if (label[root] == NO_SEGMENT)
+        {
+            label[root] = m_componentInfo.size();
+            m_componentInfo.push_back(ComponentInfo());
+        }
+        m_component[s] = label[root];
+        ComponentInfo& info = m_componentInfo[label[root]];
+        info.segments++;
+        info.attractions += ml.getSegmentRef(s).attractions.size();
+        info.miles += ml.getSegmentLength(s);
+    }
+}
+
+bool NavigatorImpl::sameComponent(const GeoCoord& a, const GeoCoord& b) const
+{
+    const vector<size_t>& atA = sm.getSegmentIds(a);
+    const vector<size_t>& atB = sm.getSegmentIds(b);
+    if (atA.empty() || atB.empty())
+        return false;
+    return m_component[atA[0]] == m_component[atB[0]]; //everything at one coordinate is connected
+}
+
+size_t NavigatorImpl::getNumComponents() const
+{
+    return m_componentInfo.size();
+}
+
+vector<ComponentInfo> NavigatorImpl::getComponentStats() const
+{
+    return vector<ComponentInfo>(m_componentInfo.begin(), m_componentInfo.end());
+}
+
+MemoryUsage NavigatorImpl::memoryUsage() const
+{
+    MemoryUsage usage;
+    ml.addMemoryUsage(usage);
+    am.addMemoryUsage(usage);
+    sm.addMemoryUsage(usage);
+    usage.turnTable = m_turnMem.bytes;
+    usage.components = m_componentMem.bytes;
+    usage.landmarks = m_landmarkMem.bytes;
+    m_landmarks.index.forEach([&usage](const GeoCoord& gc, size_t) { usage.landmarks += heapBytes(gc); });
+    usage.routeCache = m_cache.memoryUsage();
+    shared_ptr<const ClosureOverlay> overlay = closures();
+    if (overlay)
+        usage.closures = overlay->closed.capacity() * sizeof(uint64_t) + overlay->factor.capacity() * sizeof(float);
+    return usage;
+}
+
+vector<Attraction> NavigatorImpl::suggestAttractions(string name, size_t k, size_t maxEdits) const
+{
+    return am.fuzzyMatches(name, k, maxEdits);
+}
+
+void NavigatorImpl::setTurnCosts(const TurnCosts& costs)
+{
+    lock_guard<mutex> lock(m_updateMutex);
+    shared_ptr<const TurnSettings> old = atomic_load(&m_turns);
+    shared_ptr<TurnSettings> turns(new TurnSettings);
+    turns->costs = costs;
+    turns->version = old ? old->version + 1 : 1;
+    atomic_store(&m_turns, shared_ptr<const TurnSettings>(turns));
+    m_cache.clear(); //the best routes may be different now; late inserts carry the old version
+}
+
+shared_ptr<const ClosureOverlay> NavigatorImpl::closures() const
+{
+    return atomic_load(&m_closures);
+}
+
+bool NavigatorImpl::updateClosures(const vector<SegmentCostChange>& changes)
+{
+    size_t n = ml.getNumSegments();
+    for (size_t i = 0; i != changes.size(); i++)
+    {
+        if (changes[i].segId >= n || ! (changes[i].factor >= 1)) //NaN too
+            return false;
+    }
+    
+    lock_guard<mutex> lock(m_updateMutex);
+    shared_ptr<const ClosureOverlay> old = closures();
+    shared_ptr<ClosureOverlay> overlay(old ? new ClosureOverlay(*old) : new ClosureOverlay);
+    overlay->closed.resize((n + 63) / 64);
+    for (size_t i = 0; i != changes.size(); i++)
+    {
+        size_t seg = changes[i].segId;
+        double factor = changes[i].factor;
+        uint64_t bit = uint64_t(1) << (seg & 63);
+        bool wasClosed = overlay->isClosed(seg);
+        bool wasSlowed = overlay->costFactor(seg) != 1;
+        bool closes = factor == HUGE_VAL;
+        bool slows = ! closes && factor != 1;
+        if (slows && overlay->factor.empty())
+            overlay->factor.assign(n, 1);
+        
+        if (closes)
+            overlay->closed[seg >> 6] |= bit;
+        else
+            overlay->closed[seg >> 6] &= ~bit;
+        if (! overlay->factor.empty())
+            overlay->factor[seg] = slows ? float(factor) : 1;
+        overlay->numClosed += size_t(closes) - size_t(wasClosed);
+        overlay->numSlowed += size_t(slows) - size_t(wasSlowed);
+    }
+    if (overlay->numSlowed == 0)
+    {
+        overlay->factor.clear();
+        overlay->factor.shrink_to_fit();
+    }
+    overlay->version++;
+    atomic_store(&m_closures, shared_ptr<const ClosureOverlay>(overlay));
+    // A query that started before the swap may still cache its route after this, but under
+    // the old version, which nothing will look up again
+    m_cache.clear();
+    return true;
+}
+
+void NavigatorImpl::clearClosures()
+{
+    lock_guard<mutex> lock(m_updateMutex);
+    shared_ptr<const ClosureOverlay> old = closures();
+    if (! old || ! old->active())
+        return;
+    shared_ptr<ClosureOverlay> overlay(new ClosureOverlay);
+    overlay->version = old->version + 1;
+    atomic_store(&m_closures, shared_ptr<const ClosureOverlay>(overlay));
+    m_cache.clear();
+}
+
+double NavigatorImpl::getSegmentCostFactor(size_t segId) const
+{
+    shared_ptr<const ClosureOverlay> overlay = closures();
+    if (! overlay || segId >= ml.getNumSegments() || ! overlay->active())
+        return 1;
+    return overlay->isClosed(segId) ? HUGE_VAL : overlay->costFactor(segId);
+}
+
+void NavigatorImpl::setRouteCacheCapacity(size_t capacity)
+{
+    m_cache.setCapacity(capacity);
+}
+
+RouteCacheStats NavigatorImpl::getRouteCacheStats() const
+{
+    return m_cache.stats();
+}
+
+NavResult NavigatorImpl::navigate(string start, string end, vector<NavSegment> &directions, const SearchLimits& limits,
+                                  NavStats* stats) const
+{
+    TraceScope trace("navigate");
+    QueryStats query(stats);
+    vector<RouteStep> steps;
+    NavResult result = route(start, end, steps, limits);
+    if (result == NAV_SUCCESS)
+    {
+        TraceScope traceDirections("buildDirections");
+        PhaseTimer timer(t_collecting != nullptr ? &t_collecting->reconstructMicros : nullptr);
+        buildDirections(steps, directions);
+    }
+    return result;
+}
+
+NavResult NavigatorImpl::navigateSteps(string start, string end, const NavStepSink& sink, const SearchLimits& limits) const
+{
+    TraceScope trace("navigateSteps");
+    QueryStats query;
+    vector<RouteStep> steps;
+    NavResult result = route(start, end, steps, limits);
+    if (result == NAV_SUCCESS)
+        walkSteps(steps, [&sink](const NavStep& step, size_t) { sink(step); });
+    return result;
+}
+
+NavResult NavigatorImpl::navigatePolyline(string start, string end, string& polyline, int precision) const
+{
+    TraceScope trace("navigatePolyline");
+    QueryStats query;
+    vector<RouteStep> steps;
+    NavResult result = route(start, end, steps, SearchLimits());
+    if (result != NAV_SUCCESS)
+        return result;
+    vector<double> lat(steps.size()), lon(steps.size());
+    for (size_t i = 0; i != steps.size(); i++)
+    {
+        lat[i] = steps[i].coord.latitude;
+        lon[i] = steps[i].coord.longitude;
+    }
+    polyline = encodePolyline(lat.data(), lon.data(), steps.size(), precision);
+    return result;
+}
+
+const string& NavigatorImpl::getStreetName(size_t streetId) const
+{
+    return ml.getStreetName(streetId);
+}
+
+// Looks both names up and finds the route between them, from the cache if it's there
+NavResult NavigatorImpl::route(const string& start, const string& end, vector<RouteStep>& route, const SearchLimits& limits) const
+{
+    NavStats* stats = t_collecting;
+    NavStats discard; //counted into when nobody's collecting, so the counting needs no checks
+    NavStats& counts = stats != nullptr ? *stats : discard;
+    string key;
+    NavResult result;
+    double cost = 0;
+    GeoCoord sgc, egc;
+    bool cached;
+    vector<uint32_t> path;
+    shared_ptr<const ClosureOverlay> overlay = closures(); //both held until the search is done with them
+    shared_ptr<const TurnSettings> turns = atomic_load(&m_turns);
+    {
+        TraceScope trace("lookup");
+        PhaseTimer timer(stats != nullptr ? &stats->lookupMicros : nullptr);
+        counts.nameLookups++;
+        if (! am.getGeoCoord(start, sgc))
+            return NAV_BAD_SOURCE;
+        counts.nameLookups++;
+        if (! am.getGeoCoord(end, egc))
+            return NAV_BAD_DESTINATION;
+        counts.mapProbes += 2; //sameComponent finds the segments at both ends
+        if (! sameComponent(sgc, egc))
+        {
+            route.clear();
+            return NAV_NO_ROUTE;
+        }
+        key = toLowerCase(start) + '\n' + toLowerCase(end); //names can't contain newlines
+        if (overlay || turns) //so a route found under older costs can't be mistaken for a new one
+            key += '\n' + to_string(overlay ? overlay->version : 0) + '/' + to_string(turns ? turns->version : 0);
+        cached = m_cache.lookup(key, result, path, cost, counts.mapProbes);
+    }
+    if (stats != nullptr)
+        stats->cacheHit = cached;
+    if (cached)
+    {
+        TraceScope traceReconstruct("reconstruct");
+        PhaseTimer timer(stats != nullptr ? &stats->reconstructMicros : nullptr);
+        route.clear();
+        if (result == NAV_SUCCESS)
+            unpackRoute(path, sgc, egc, route);
+    }
+    else
+    {
+        result = findRoute<BuildRoute>(sgc, egc, route, limits, overlay && overlay->active() ? overlay.get() : nullptr,
+                                       turns && turns->active() ? &turns->costs : nullptr, cost);
+        if (result == NAV_SUCCESS || result == NAV_NO_ROUTE) //a timeout says nothing about the route
+        {
+            packRoute(route, path);
+            m_cache.insert(key, result, path, cost, counts.mapProbes);
+        }
+    }
+    if (stats != nullptr)
+        stats->routeCost = BuildRoute::Metric::reported<BuildRoute::Units>(cost);
+    return result;
+}
+
+// A* over the coordinates of the map; fills route from start to end. closures is null when
+// nothing is closed or slowed, which keeps the check out of the way of ordinary queries,
+// and turns is null when turning is free.
+template<class Policy>
+NavResult NavigatorImpl::findRoute(const GeoCoord& sgc, const GeoCoord& egc, vector<RouteStep>& route, const SearchLimits& limits,
+                                   const ClosureOverlay* closures, const TurnCosts* turns, double& cost) const
+{
+    // With turn costs the cheapest way on from a corner depends on the segment we came in on
+    if (turns != nullptr)
+        return findTurnRoute<Policy>(sgc, egc, route, limits, closures, *turns, cost);
+    
+    TraceScope trace("search");
+    SearchCounters counters(t_collecting);
+    SearchScratch& scratch = searchScratch();
+    scratch.reset();
+    size_t allocatedBefore = scratch.mem.allocated;
+    TrackedVector<node*>& open = scratch.open;
+    MyMap<GeoCoord, double>& bestG = scratch.bestG;
+    const vector<size_t>& endSegs = sm.getSegmentIds(egc); //the destination is somewhere along one of these
+    counters.probes++;
+    
+    typedef typename Policy::Heuristic Heuristic;
+    typedef typename Policy::Metric Metric;
+    typedef typename Policy::Heap Heap;
+    typedef typename Policy::Units Units;
+    
+    const double* targetDist = nullptr;
+    if (Heuristic::USES_LANDMARKS)
+    {
+        const size_t* row = m_landmarks.index.find(egc);
+        if (row != nullptr)
+            targetDist = &m_landmarks.dist[*row * Landmarks::COUNT];
+        counters.probes++;
+    }
+    
+    node* first = scratch.newNode();
+    first->coord = sgc;
+    scratch.next.assign(1, sgc);
+    Heuristic::estimate(m_landmarks, targetDist, egc, scratch, 1);
+    first->h = Metric::template bound<Units>(scratch.dist[0]);
+    Heap::push(open, first);
+    counters.pushes++;
+    counters.peakHeap = 1;
+    counters.probes++;
+    bestG.associate(sgc, 0);
+    
+    node* FINAL = nullptr;
+    int sinceCheck = 0;
+    while (! open.empty())
+    {
+        if (++sinceCheck == SearchLimits::CHECK_EVERY)
+        {
+            sinceCheck = 0;
+            NavResult stop = limits.check();
+            if (stop != NAV_SUCCESS)
+                return stop;
+        }
+        
+        node* cur = Heap::pop(open);
+        counters.pops++;
+        
+        const double* best = bestG.find(cur->coord);
+        counters.probes++;
+        if (best != nullptr && *best < cur->g) //we already found a shorter way here
+            continue;
+        if (cur->coord == egc)
+        {
+            FINAL = cur;
+            break;
+        }
+        
+        expand(cur->coord, egc, endSegs, false, scratch);
+        counters.expanded++;
+        counters.probes++;
+        
+        // one batch for every neighbour's heuristic
+        const TrackedVector<GeoCoord>& next = scratch.next;
+        size_t m = next.size();
+        Heuristic::estimate(m_landmarks, targetDist, egc, scratch, m);
+        counters.relaxed += m;
+        counters.probes += Heuristic::USES_LANDMARKS ? m : 0;
+        
+        for (size_t j = 0; j != m; j++)
+        {
+            size_t seg = scratch.nextSeg[j];
+            double miles = scratch.nextCost[j];
+            if (closures != nullptr)
+            {
+                if (closures->isClosed(seg))
+                    continue;
+                miles *= closures->costFactor(seg); //the factors can only raise costs, so the heuristics still hold
+            }
+            double g = cur->g + Metric::template cost<Units>(miles, seg, m_segmentSpeed);
+            const double* known = bestG.find(next[j]);
+            counters.probes++;
+            if (known != nullptr && *known <= g)
+                continue;
+            bestG.associate(next[j], g);
+            counters.probes++;
+            
+            node* child = scratch.newNode();
+            child->parent = cur;
+            child->coord = next[j];
+            child->segId = scratch.nextSeg[j];
+            child->step = scratch.nextCost[j];
+            child->g = g;
+            child->h = Metric::template bound<Units>(scratch.dist[j]);
+            Heap::push(open, child);
+            counters.pushes++;
+            if (open.size() > counters.peakHeap)
+                counters.peakHeap = open.size();
+        }
+    }
+    counters.searchDone();
+    
+    TraceScope traceReconstruct("reconstruct");
+    PhaseTimer timer(counters.out != nullptr ? &counters.out->reconstructMicros : nullptr);
+    route.clear();
+    for (node* cur = FINAL; cur != nullptr; cur = cur->parent)
+    {
+        if (cur->parent == nullptr)
+            pushStep(route, makeStep(cur->coord, cur->coord, NO_SEGMENT, 0), counters.bytes);
+        else
+            pushStep(route, makeStep(cur->parent->coord, cur->coord, cur->segId, cur->step), counters.bytes);
+    }
+    reverse(route.begin(), route.end());
+    counters.bytes += scratch.mem.allocated - allocatedBefore;
+    cost = FINAL != nullptr ? FINAL->g : 0;
+    return FINAL != nullptr ? NAV_SUCCESS : NAV_NO_ROUTE;
+}
+
+// findRoute with turn costs. The search is over segment ends - where we are and which way we
+// came in - in the flat turn tables, so a step is array lookups with no maps. Nodes get their
+// heuristic once per search, in batches. egc may be partway along a segment, and then it's a
+// state of its own after the last segment end; sgc partway along starts from both ends of
+// its segments.
+template<class Policy>
+NavResult NavigatorImpl::findTurnRoute(const GeoCoord& sgc, const GeoCoord& egc, vector<RouteStep>& route,
+                                       const SearchLimits& limits, const ClosureOverlay* closures,
+                                       const TurnCosts& turns, double& cost) const
+{
+    TraceScope trace("search");
+    SearchCounters counters(t_collecting);
+    SearchScratch& scratch = searchScratch();
+    size_t allocatedBefore = scratch.mem.allocated;
+    
+    typedef typename Policy::Heuristic Heuristic;
+    typedef typename Policy::Metric Metric;
+    typedef typename Policy::Units Units;
+    
+    route.clear();
+    cost = 0;
+    if (sgc == egc)
+    {
+        pushStep(route, makeStep(sgc, sgc, NO_SEGMENT, 0), counters.bytes);
+        return NAV_SUCCESS;
+    }
+    
+    const uint32_t TARGET = uint32_t(m_endNode.size());
+    const uint32_t NO_END = uint32_t(-1); //parent of what's reached straight from sgc
+    scratch.startTurnSearch(TARGET + 1, m_turnFirst.size());
+    uint32_t stamp = scratch.stamp;
+    TrackedVector<TurnEntry>& open = scratch.turnOpen;
+    const vector<size_t>& startSegs = sm.getSegmentIds(sgc);
+    const vector<size_t>& endSegs = sm.getSegmentIds(egc);
+    counters.probes += 2;
+    uint32_t startNode = nodeAt(sgc, startSegs);
+    uint32_t targetNode = nodeAt(egc, endSegs);
+    size_t targetSeg = NO_SEGMENT; //what the step to TARGET is along
+    
+    const double* targetDist = nullptr;
+    if (Heuristic::USES_LANDMARKS)
+    {
+        const size_t* row = m_landmarks.index.find(egc);
+        if (row != nullptr)
+            targetDist = &m_landmarks.dist[*row * Landmarks::COUNT];
+        counters.probes++;
+    }
+    const double penalty[4] = { 0, turns.left, turns.right, turns.uTurn }; //by TurnClass
+    
+    // heuristics for the nodes these ends are at, if they don't have one yet
+    auto estimate = [&](const uint32_t* ends, size_t count) {
+        scratch.next.clear();
+        scratch.unestimated.clear();
+        for (size_t i = 0; i != count; i++)
+        {
+            uint32_t v = m_endNode[ends[i]];
+            if (scratch.nodeStamp[v] == stamp)
+                continue;
+            scratch.nodeStamp[v] = stamp;
+            scratch.unestimated.push_back(v);
+            scratch.next.push_back(endCoord(ends[i]));
+        }
+        if (scratch.unestimated.empty())
+            return;
+        Heuristic::estimate(m_landmarks, targetDist, egc, scratch, scratch.unestimated.size());
+        for (size_t i = 0; i != scratch.unestimated.size(); i++)
+            scratch.nodeH[scratch.unestimated[i]] = Metric::template bound<Units>(scratch.dist[i]);
+        counters.probes += Heuristic::USES_LANDMARKS ? scratch.unestimated.size() : 0;
+    };
+    auto relax = [&](uint32_t end, double g, uint32_t parent) -> bool {
+        if (scratch.endStamp[end] == stamp && scratch.endG[end] <= g)
+            return false;
+        scratch.endStamp[end] = stamp;
+        scratch.endG[end] = g;
+        scratch.endParent[end] = parent;
+        TurnEntry e = { g + (end == TARGET ? 0 : scratch.nodeH[m_endNode[end]]), g, end };
+        open.push_back(e);
+        push_heap(open.begin(), open.end(), turnEntryCompare());
+        counters.pushes++;
+        if (open.size() > counters.peakHeap)
+            counters.peakHeap = open.size();
+        return true;
+    };
+    // everywhere one step from node v, having come in through end in (NO_END: this is sgc)
+    auto expandNode = [&](uint32_t v, uint32_t in, double g) {
+        uint32_t first = m_exitFirst[v], last = m_exitFirst[v + 1];
+        const unsigned char* turns = in == NO_END ? nullptr
+                                   : &m_turnClass[m_turnFirst[v] + size_t(m_endRow[in]) * (last - first)];
+        estimate(&m_exitTo[first], last - first);
+        counters.relaxed += last - first;
+        for (uint32_t x = first; x != last; x++)
+        {
+            uint32_t to = m_exitTo[x];
+            size_t seg = to >> 1;
+            double factor = 1;
+            if (closures != nullptr)
+            {
+                if (closures->isClosed(seg))
+                    continue;
+                factor = closures->costFactor(seg);
+            }
+            double turn = turns == nullptr ? 0 : Metric::template cost<Units>(penalty[turns[x - first]], seg, m_segmentSpeed);
+            relax(to, g + turn + Metric::template cost<Units>(m_exitMiles[x] * factor, seg, m_segmentSpeed), in);
+            if (targetNode == NO_NODE && find(endSegs.begin(), endSegs.end(), seg) != endSegs.end())
+            {
+                const GeoCoord& at = in == NO_END ? sgc : endCoord(in);
+                double miles = distanceEarthMiles(at, egc) * factor;
+                if (relax(TARGET, g + turn + Metric::template cost<Units>(miles, seg, m_segmentSpeed), in))
+                    targetSeg = seg;
+            }
+        }
+    };
+    
+    if (startNode != NO_NODE)
+        expandNode(startNode, NO_END, 0);
+    else
+    {
+        for (size_t i = 0; i != startSegs.size(); i++)
+        {
+            size_t seg = startSegs[i];
+            double factor = 1;
+            if (closures != nullptr)
+            {
+                if (closures->isClosed(seg))
+                    continue;
+                factor = closures->costFactor(seg);
+            }
+            uint32_t ends[2] = { uint32_t(2 * seg), uint32_t(2 * seg + 1) };
+            estimate(ends, 2);
+            for (int e = 0; e != 2; e++)
+                relax(ends[e], Metric::template cost<Units>(distanceEarthMiles(sgc, endCoord(ends[e])) * factor, seg, m_segmentSpeed),
+                      NO_END);
+            if (targetNode == NO_NODE && find(endSegs.begin(), endSegs.end(), seg) != endSegs.end()
+                && relax(TARGET, Metric::template cost<Units>(distanceEarthMiles(sgc, egc) * factor, seg, m_segmentSpeed), NO_END))
+                targetSeg = seg;
+        }
+    }
+    
+    uint32_t FINAL = NO_END;
+    int sinceCheck = 0;
+    while (! open.empty())
+    {
+        if (++sinceCheck == SearchLimits::CHECK_EVERY)
+        {
+            sinceCheck = 0;
+            NavResult stop = limits.check();
+            if (stop != NAV_SUCCESS)
+                return stop;
+        }
+        
+        TurnEntry cur = open.front();
+        pop_heap(open.begin(), open.end(), turnEntryCompare());
+        open.pop_back();
+        counters.pops++;
+        if (cur.g > scratch.endG[cur.end]) //we already found a cheaper way here
+            continue;
+        if (cur.end == TARGET || m_endNode[cur.end] == targetNode)
+        {
+            FINAL = cur.end;
+            break;
+        }
+        expandNode(m_endNode[cur.end], cur.end, cur.g);
+        counters.expanded++;
+    }
+    counters.searchDone();
+    
+    TraceScope traceReconstruct("reconstruct");
+    PhaseTimer timer(counters.out != nullptr ? &counters.out->reconstructMicros : nullptr);
+    for (uint32_t at = FINAL; at != NO_END; at = scratch.endParent[at])
+    {
+        uint32_t from = scratch.endParent[at];
+        const GeoCoord& fromCoord = from == NO_END ? sgc : endCoord(from);
+        if (at == TARGET)
+        {
+            pushStep(route, makeStep(fromCoord, egc, targetSeg, distanceEarthMiles(fromCoord, egc)), counters.bytes);
+            continue;
+        }
+        size_t seg = at >> 1;
+        const GeoSegment& gs = ml.getSegmentRef(seg).segment;
+        bool wholeSegment = fromCoord == gs.start || fromCoord == gs.end;
+        pushStep(route, makeStep(fromCoord, endCoord(at), seg,
+                                 wholeSegment ? ml.getSegmentLength(seg) : distanceEarthMiles(fromCoord, endCoord(at))),
+                 counters.bytes);
+    }
+    if (FINAL == NO_END)
+        return NAV_NO_ROUTE;
+    cost = scratch.endG[FINAL];
+    pushStep(route, makeStep(sgc, sgc, NO_SEGMENT, 0), counters.bytes);
+    reverse(route.begin(), route.end());
+    counters.bytes += scratch.mem.allocated - allocatedBefore;
+    return NAV_SUCCESS;
+}
+
+// Every combination we ship, so a change that breaks one that isn't the build's choice still
+// fails to compile here
+template NavResult NavigatorImpl::findRoute<RoutePolicy<HaversineHeuristic, DistanceMetric, BinaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<HaversineHeuristic, DistanceMetric, BinaryHeap, Kilometers> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<EquirectangularHeuristic, DistanceMetric, QuaternaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<LandmarkHeuristic, DistanceMetric, QuaternaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<ZeroHeuristic, DistanceMetric, BinaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<HaversineHeuristic, TimeMetric, BinaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+template NavResult NavigatorImpl::findRoute<RoutePolicy<LandmarkHeuristic, TimeMetric, QuaternaryHeap, Miles> >(
+    const GeoCoord&, const GeoCoord&, vector<RouteStep>&, const SearchLimits&, const ClosureOverlay*,
+    const TurnCosts*, double&) const;
+
+// Landmarks are picked farthest-first: the start of segment 0, then whichever node is
+// farthest (by road) from the landmarks so far. One Dijkstra per landmark over every
+// segment end and attraction.
+void NavigatorImpl::buildLandmarks()
+{
+    TraceScope trace("Navigator::buildLandmarks");
+    vector<GeoCoord> nodes;
+    for (size_t s = 0; s != ml.getNumSegments(); s++)
+    {
+        const StreetSegment& seg = ml.getSegmentRef(s);
+        const GeoCoord* here[2] = { &seg.segment.start, &seg.segment.end };
+        for (int e = 0; e != 2; e++)
+        {
+            if (m_landmarks.index.find(*here[e]) == nullptr)
+            {
+                m_landmarks.index.associate(*here[e], nodes.size());
+                nodes.push_back(*here[e]);
+            }
+        }
+        for (size_t a = 0; a != seg.attractions.size(); a++)
+        {
+            if (m_landmarks.index.find(seg.attractions[a].geocoordinates) == nullptr)
+            {
+                m_landmarks.index.associate(seg.attractions[a].geocoordinates, nodes.size());
+                nodes.push_back(seg.attractions[a].geocoordinates);
+            }
+        }
+    }
+    if (nodes.empty())
+        return;
+    
+    size_t n = nodes.size();
+    m_landmarks.dist.assign(n * Landmarks::COUNT, HUGE_VAL);
+    vector<double> nearest(n, HUGE_VAL); //road miles to the closest landmark so far
+    SearchScratch& scratch = searchScratch();
+    const vector<size_t> none;
+    size_t landmark = 0;
+    for (size_t l = 0; l != Landmarks::COUNT; l++)
+    {
+        typedef pair<double, size_t> Entry;
+        priority_queue<Entry, vector<Entry>, greater<Entry> > open;
+        m_landmarks.dist[landmark * Landmarks::COUNT + l] = 0;
+        open.push(Entry(0, landmark));
+        while (! open.empty())
+        {
+            Entry cur = open.top();
+            open.pop();
+            if (cur.first > m_landmarks.dist[cur.second * Landmarks::COUNT + l])
+                continue;
+            expand(nodes[cur.second], nodes[cur.second], none, true, scratch);
+            for (size_t j = 0; j != scratch.next.size(); j++)
+            {
+                size_t to = *m_landmarks.index.find(scratch.next[j]);
+                double d = cur.first + scratch.nextCost[j];
+                double& known = m_landmarks.dist[to * Landmarks::COUNT + l];
+                if (d < known)
+                {
+                    known = d;
+                    open.push(Entry(d, to));
+                }
+            }
+        }
+        
+        size_t farthest = landmark;
+        for (size_t i = 0; i != n; i++)
+        {
+            double d = m_landmarks.dist[i * Landmarks::COUNT + l];
+            if (d < nearest[i])
+                nearest[i] = d;
+            if (nearest[i] != HUGE_VAL && nearest[i] > nearest[farthest])
+                farthest = i;
+        }
+        landmark = farthest;
+    }
+}
+
+// There's no speed data in the map, so guess from what the street is called
+void NavigatorImpl::buildSegmentSpeeds()
+{
+    TraceScope trace("Navigator::buildSegmentSpeeds");
+    vector<double> streetSpeed(ml.getNumStreets());
+    for (size_t i = 0; i != streetSpeed.size(); i++)
+    {
+        string name = toLowerCase(ml.getStreetName(i));
+        if (name.find("freeway") != string::npos || name.find("motorway") != string::npos
+            || name.find("highway") != string::npos)
+            streetSpeed[i] = TimeMetric::MAX_MPH;
+        else if (name.find("avenue") != string::npos || name.find("boulevard") != string::npos
+                 || name.find("road") != string::npos)
+            streetSpeed[i] = 35;
+        else
+            streetSpeed[i] = 25;
+    }
+    m_segmentSpeed.resize(ml.getNumSegments());
+    for (size_t s = 0; s != m_segmentSpeed.size(); s++)
+        m_segmentSpeed[s] = streetSpeed[ml.getStreetId(s)];
+}
+
+// Where one step from cur can get to: both ends of every segment at cur, plus attractions
+// along those segments - all of them if allAttractions, otherwise only target, on targetSegs.
+// A step from one end of a segment to the other costs the length worked out at load; only
+// steps to or from a point partway along need the distance formula.
+void NavigatorImpl::expand(const GeoCoord& cur, const GeoCoord& target, const vector<size_t>& targetSegs,
+                           bool allAttractions, SearchScratch& scratch) const
+{
+    TrackedVector<GeoCoord>& next = scratch.next;
+    TrackedVector<size_t>& nextSeg = scratch.nextSeg;
+    TrackedVector<double>& nextCost = scratch.nextCost;
+    next.clear();
+    nextSeg.clear();
+    nextCost.clear();
+    
+    const vector<size_t>& ids = sm.getSegmentIds(cur);
+    for (size_t i = 0; i != ids.size(); i++)
+    {
+        const StreetSegment& seg = ml.getSegmentRef(ids[i]);
+        bool atStart = cur == seg.segment.start;
+        bool atEnd = cur == seg.segment.end;
+        
+        if (! atStart)
+        {
+            next.push_back(seg.segment.start);
+            nextSeg.push_back(ids[i]);
+            nextCost.push_back(atEnd ? ml.getSegmentLength(ids[i]) : distanceEarthMiles(cur, seg.segment.start));
+        }
+        if (! atEnd)
+        {
+            next.push_back(seg.segment.end);
+            nextSeg.push_back(ids[i]);
+            nextCost.push_back(atStart ? ml.getSegmentLength(ids[i]) : distanceEarthMiles(cur, seg.segment.end));
+        }
+        
+        if (allAttractions)
+        {
+            for (size_t j = 0; j != seg.attractions.size(); j++)
+            {
+                const GeoCoord& gc = seg.attractions[j].geocoordinates;
+                if (gc == cur)
+                    continue;
+                next.push_back(gc);
+                nextSeg.push_back(ids[i]);
+                nextCost.push_back(distanceEarthMiles(cur, gc));
+            }
+        }
+        else if (! (target == cur) && find(targetSegs.begin(), targetSegs.end(), ids[i]) != targetSegs.end())
+        {
+            next.push_back(target);
+            nextSeg.push_back(ids[i]);
+            nextCost.push_back(distanceEarthMiles(cur, target));
+        }
+    }
+}
+
+RouteStep NavigatorImpl::makeStep(const GeoCoord& from, const GeoCoord& to, size_t segId, double distance) const
+{
+    RouteStep step;
+    step.coord = to;
+    step.segId = segId;
+    step.distance = distance;
+    step.angle = 0;
+    if (segId != NO_SEGMENT)
+    {
+        const GeoSegment& gs = ml.getSegmentRef(segId).segment;
+        if (from == gs.start && to == gs.end)
+            step.angle = ml.getSegmentBearing(segId, false);
+        else if (from == gs.end && to == gs.start)
+            step.angle = ml.getSegmentBearing(segId, true);
+        else //partway along, to or from an attraction
+            step.angle = angleOfLine(GeoSegment(from, to));
+    }
+    return step;
+}
+
+// A route's path for the cache: after the first step, which only says where we start, one
+// entry per step of segId << 2 | where it went - to the segment's start (0), its end (1) or,
+// partway along, the destination (2). unpackRoute appends the steps to route, working the
+// distances out the way the searches do: the segment's length between its ends, the
+// formula otherwise.
+void NavigatorImpl::packRoute(const vector<RouteStep>& route, vector<uint32_t>& path) const
+{
+    path.clear();
+    for (size_t i = 1; i < route.size(); i++)
+    {
+        const GeoSegment& gs = ml.getSegmentRef(route[i].segId).segment;
+        uint32_t to = route[i].coord == gs.start ? 0 : route[i].coord == gs.end ? 1 : 2;
+        path.push_back(uint32_t(route[i].segId) << 2 | to);
+    }
+}
+
+void NavigatorImpl::unpackRoute(const vector<uint32_t>& path, const GeoCoord& sgc, const GeoCoord& egc,
+                                vector<RouteStep>& route) const
+{
+    route.reserve(path.size() + 1);
+    route.push_back(makeStep(sgc, sgc, NO_SEGMENT, 0));
+    for (size_t i = 0; i != path.size(); i++)
+    {
+        size_t seg = path[i] >> 2;
+        const GeoSegment& gs = ml.getSegmentRef(seg).segment;
+        const GeoCoord& from = route.back().coord;
+        const GeoCoord& to = (path[i] & 3) == 0 ? gs.start : (path[i] & 3) == 1 ? gs.end : egc;
+        bool wholeSegment = (path[i] & 3) != 2 && (from == gs.start || from == gs.end);
+        route.push_back(makeStep(from, to, seg, wholeSegment ? ml.getSegmentLength(seg) : distanceEarthMiles(from, to)));
+    }
+}
+
+// Dijkstra from start that stops once the nearest open node is past maxDistance.
+// Attractions are nodes too, so they are reached partway along their segment.
+NavResult NavigatorImpl::reachable(string start, double maxDistance, Reachability& result, const SearchLimits& limits) const
+{
+    TraceScope trace("reachable");
+    result.nodes.clear();
+    result.attractions.clear();
+    GeoCoord sgc;
+    if (! am.getGeoCoord(start, sgc))
+        return NAV_BAD_SOURCE;
+    
+    SearchScratch& scratch = searchScratch();
+    scratch.reset();
+    TrackedVector<node*>& open = scratch.open;
+    MyMap<GeoCoord, double>& bestG = scratch.bestG;
+    MyMap<string, bool> reported; //an attraction can be listed on more than one segment
+    shared_ptr<const ClosureOverlay> overlay = closures();
+    const ClosureOverlay* closed = overlay && overlay->numClosed != 0 ? overlay.get() : nullptr;
+    
+    node* first = scratch.newNode();
+    first->coord = sgc;
+    open.push_back(first);
+    bestG.associate(sgc, 0);
+    
+    int sinceCheck = 0;
+    while (! open.empty())
+    {
+        if (++sinceCheck == SearchLimits::CHECK_EVERY)
+        {
+            sinceCheck = 0;
+            NavResult stop = limits.check();
+            if (stop != NAV_SUCCESS)
+                return stop;
+        }
+        
+        pop_heap(open.begin(), open.end(), nodeCompare());
+        node* cur = open.back();
+        open.pop_back();
+        
+        const double* best = bestG.find(cur->coord);
+        if (best != nullptr && *best < cur->g)
+            continue;
+        if (cur->g > maxDistance) //everything left is farther still
+            break;
+        
+        ReachableNode reached;
+        reached.coord = cur->coord;
+        reached.distance = cur->g;
+        result.nodes.push_back(reached);
+        
+        const vector<size_t>& ids = sm.getSegmentIds(cur->coord);
+        for (size_t i = 0; i != ids.size(); i++)
+        {
+            const vector<Attraction>& attractions = ml.getSegmentRef(ids[i]).attractions;
+            for (size_t j = 0; j != attractions.size(); j++)
+            {
+                if (attractions[j].geocoordinates == cur->coord && reported.find(attractions[j].name) == nullptr)
+                {
+                    reported.associate(attractions[j].name, true);
+                    ReachableAttraction a;
+                    a.name = attractions[j].name;
+                    a.coord = cur->coord;
+                    a.distance = cur->g;
+                    result.attractions.push_back(a);
+                }
+            }
+        }
+        
+        expand(cur->coord, cur->coord, ids, true, scratch);
+        for (size_t j = 0; j != scratch.next.size(); j++)
+        {
+            const GeoCoord& next = scratch.next[j];
+            double g = cur->g + scratch.nextCost[j];
+            if (g > maxDistance || (closed != nullptr && closed->isClosed(scratch.nextSeg[j])))
+                continue;
+            const double* known = bestG.find(next);
+            if (known != nullptr && *known <= g)
+                continue;
+            bestG.associate(next, g);
+            
+            node* child = scratch.newNode();
+            child->parent = cur;
+            child->coord = next;
+            child->g = g;
+            open.push_back(child);
+            push_heap(open.begin(), open.end(), nodeCompare());
+        }
+    }
+    return NAV_SUCCESS;
+}
+
+// Where Dijkstra from one end of a query got to: each settled coordinate, how far it is
+// from the root, and the coordinate and segment it was reached from.
+struct NavigatorImpl::ShortestPathTree
+{
+    struct Entry
+    {
+        double dist;
+        GeoCoord parent;
+        size_t segId;
+        bool isRoot;
+    };
+    MyMap<GeoCoord, Entry> entries;
+    vector<GeoCoord> settled; //in order of distance
+};
+
+// Dijkstra from root. Once target is settled at distance D it keeps going until everything
+// within maxStretch * D is settled, and sets targetDist to D (or -1 if target can't be reached).
+// mid is the attraction at the other end of the query, reachable partway along midSegs.
+NavResult NavigatorImpl::growTree(const GeoCoord& root, const GeoCoord& target, const vector<size_t>& midSegs,
+                                  const GeoCoord& mid, double maxStretch, const ClosureOverlay* closures,
+                                  const SearchLimits& limits, ShortestPathTree& tree, double& targetDist) const
+{
+    SearchScratch& scratch = searchScratch();
+    scratch.reset();
+    TrackedVector<node*>& open = scratch.open;
+    MyMap<GeoCoord, double>& bestG = scratch.bestG;
+    
+    node* first = scratch.newNode();
+    first->coord = root;
+    open.push_back(first);
+    bestG.associate(root, 0);
+    
+    targetDist = -1;
+    double bound = 1e300;
+    int sinceCheck = 0;
+    while (! open.empty())
+    {
+        if (++sinceCheck == SearchLimits::CHECK_EVERY)
+        {
+            sinceCheck = 0;
+            NavResult stop = limits.check();
+            if (stop != NAV_SUCCESS)
+                return stop;
+        }
+        
+        pop_heap(open.begin(), open.end(), nodeCompare());
+        node* cur = open.back();
+        open.pop_back();
+        
+        const double* best = bestG.find(cur->coord);
+        if (best != nullptr && *best < cur->g) //only the node that set bestG gets settled
+            continue;
+        if (cur->g > bound)
+            break;
+        
+        ShortestPathTree::Entry e;
+        e.dist = cur->g;
+        e.isRoot = cur->parent == nullptr;
+        if (! e.isRoot)
+            e.parent = cur->parent->coord;
+        e.segId = cur->segId;
+        tree.entries.associate(cur->coord, e);
+        tree.settled.push_back(cur->coord);
+        if (cur->coord == target)
+        {
+            targetDist = cur->g;
+            bound = maxStretch * targetDist;
+        }
+        
+        expand(cur->coord, mid, midSegs, false, scratch);
+        for (size_t j = 0; j != scratch.next.size(); j++)
+        {
+            const GeoCoord& next = scratch.next[j];
+            if (closures != nullptr && closures->isClosed(scratch.nextSeg[j]))
+                continue;
+            double g = cur->g + scratch.nextCost[j];
+            const double* known = bestG.find(next);
+            if (known != nullptr && *known <= g)
+                continue;
+            bestG.associate(next, g);
+            
+            node* child = scratch.newNode();
+            child->parent = cur;
+            child->coord = next;
+            child->segId = scratch.nextSeg[j];
+            child->g = g;
+            open.push_back(child);
+            push_heap(open.begin(), open.end(), nodeCompare());
+        }
+    }
+    return NAV_SUCCESS;
 }
 
-NavResult NavigatorImpl::navigate(string start, string end, vector<NavSegment> &directions) const
+// Via-node alternatives: grow a shortest path tree from each end, then every coordinate v
+// settled by both gives the route start -> v -> end for the price of two lookups. Cheapest
+// via routes are tried first; a via node on the best route gives the best route itself, and
+// via nodes on the same plateau (stretch where both trees agree) give the same route, which
+// the overlap test throws out.
+NavResult NavigatorImpl::alternatives(string start, string end, size_t k, vector<NavRoute>& routes,
+                                      double maxStretch, double maxOverlap, const SearchLimits& limits) const
 {
+    TraceScope trace("alternatives");
+    routes.clear();
     GeoCoord sgc;
     if (! am.getGeoCoord(start, sgc))
         return NAV_BAD_SOURCE;
@@ -80,118 +2101,157 @@ NavResult NavigatorImpl::navigate(string start, string end, vector<NavSegment> &
     if (! am.getGeoCoord(end, egc))
         return NAV_BAD_DESTINATION;
     
-    priority_queue<node*> open;
-    //vector<node*> close;
-    MyMap<GeoCoord, string> close;
+    if (! sameComponent(sgc, egc))
+        return NAV_NO_ROUTE;
+    NavResult stop = limits.check(); //no sense growing two trees for a query that's already given up
+    if (stop != NAV_SUCCESS)
+        return stop;
+    
+    shared_ptr<const ClosureOverlay> overlay = closures(); //both trees see the same closures
+    const ClosureOverlay* closed = overlay && overlay->numClosed != 0 ? overlay.get() : nullptr;
+    ShortestPathTree forward, backward;
+    double best, back;
+    stop = growTree(sgc, egc, sm.getSegmentIds(egc), egc, maxStretch, closed, limits, forward, best);
+    if (stop != NAV_SUCCESS)
+        return stop;
+    if (best < 0)
+        return NAV_NO_ROUTE;
+    stop = growTree(egc, sgc, sm.getSegmentIds(sgc), sgc, maxStretch, closed, limits, backward, back);
+    if (stop != NAV_SUCCESS)
+        return stop;
     
-    vector<StreetSegment> begin = sm.getSegments(sgc);
-    for (int i =0; i!= begin.size(); i++) //our first nodes (so no parent)
+    struct Via
     {
-        
-        node* first = new node;
-        first->coord = sgc;
-        first->seg = begin[i];
-        first->h = distanceEarthMiles(sgc, egc);
-        open.push(first);
-    }   ///should only have a couple nodes;
-    int foundit=0;
+        double cost;
+        GeoCoord coord;
+        bool operator<(const Via& other) const { return cost < other.cost; }
+    };
+    vector<Via> vias;
+    for (size_t i = 0; i != forward.settled.size(); i++)
+    {
+        const ShortestPathTree::Entry* b = backward.entries.find(forward.settled[i]);
+        if (b == nullptr)
+            continue;
+        Via v;
+        v.cost = forward.entries.find(forward.settled[i])->dist + b->dist;
+        v.coord = forward.settled[i];
+        if (v.cost <= maxStretch * best + 1e-12)
+            vias.push_back(v);
+    }
+    stable_sort(vias.begin(), vias.end());
     
-    node* FINAL = nullptr;
-    while ((! open.empty()) && foundit==0)
+    MyMap<GeoCoord, vector<GeoCoord> > usedEdges; //edges of the routes taken so far, both directions
+    for (size_t i = 0; i != vias.size() && routes.size() < k; i++)
     {
-        
-        node* cur = open.top();
-        vector<StreetSegment> check = sm.getSegments(egc);
-        int foundit = 0;
-        for(int i =0; i!= check.size(); i++)
-        {
-            if (cur->seg.streetName == check.at(i).streetName)
-            {   FINAL = cur;
-                foundit++;
+        if ((i + 1) % SearchLimits::CHECK_EVERY == 0 && (stop = limits.check()) != NAV_SUCCESS)
+        {
+            routes.clear();
+            return stop;
+        }
+        vector<RouteStep> route;
+        GeoCoord at = vias[i].coord;
+        for (;;) //back up the forward tree to the start
+        {
+            const ShortestPathTree::Entry* e = forward.entries.find(at);
+            if (e->isRoot)
+            {
+                route.push_back(makeStep(at, at, NO_SEGMENT, 0));
                 break;
             }
+            route.push_back(makeStep(e->parent, at, e->segId, e->dist - forward.entries.find(e->parent)->dist));
+            at = e->parent;
+        }
+        reverse(route.begin(), route.end());
+        at = vias[i].coord;
+        for (;;) //then down the backward tree to the end
+        {
+            const ShortestPathTree::Entry* e = backward.entries.find(at);
+            if (e->isRoot)
+                break;
+            route.push_back(makeStep(at, e->parent, e->segId, e->dist - backward.entries.find(e->parent)->dist));
+            at = e->parent;
         }
         
-        open.pop();
+        MyMap<GeoCoord, bool> seen; //the two halves can cross; such a route has a loop in it
+        bool loops = false;
+        double shared = 0;
+        for (size_t j = 0; j != route.size() && ! loops; j++)
+        {
+            if (seen.find(route[j].coord) != nullptr)
+                loops = true;
+            seen.associate(route[j].coord, true);
+            if (j == 0)
+                continue;
+            const vector<GeoCoord>* adj = usedEdges.find(route[j-1].coord);
+            if (adj != nullptr && find(adj->begin(), adj->end(), route[j].coord) != adj->end())
+                shared += route[j].distance;
+        }
+        if (loops || (! routes.empty() && shared > maxOverlap * vias[i].cost))
+            continue;
         
-        vector<StreetSegment> generate = sm.getSegments(cur->coord);
-        vector<node*> justincase;
-        for (int i =0; i!= generate.size(); i++) //our first nodes (so no parent)
+        for (size_t j = 1; j < route.size(); j++)
         {
-            
-            node* child1 = new node; //start of a segment
-            child1->parent = cur;
-            child1->coord = generate.at(i).segment.start;
-            child1->seg = generate[i];
-            child1->g += distanceEarthMiles(cur->coord, child1->coord);
-            child1->h = distanceEarthMiles(child1->coord, egc);
-            
-            if (! close.find(child1->coord))
-            {
-                close.associate(child1->coord, "Visited");
-                open.push(child1);
-            }
-            
-            //justincase.push_back(child1);
-            
-            
-            node* child2 = new node; //end of a segment
-            child2->parent = cur;
-            child2->coord = generate.at(i).segment.end;
-            child2->seg = generate[i];
-            child2->g += distanceEarthMiles(cur->coord, child1->coord);
-            child2->h = distanceEarthMiles(child1->coord, egc);
-           // justincase.push_back(child1);
-            
-            if (! close.find(child2->coord))
-            {
-                close.associate(child2->coord, "Visited");
-                open.push(child2);
-            }
-   
+            vector<GeoCoord>* from = usedEdges.find(route[j-1].coord);
+            if (from == nullptr)
+                usedEdges.associate(route[j-1].coord, vector<GeoCoord>(1, route[j].coord));
+            else
+                from->push_back(route[j].coord);
+            vector<GeoCoord>* to = usedEdges.find(route[j].coord);
+            if (to == nullptr)
+                usedEdges.associate(route[j].coord, vector<GeoCoord>(1, route[j-1].coord));
+            else
+                to->push_back(route[j-1].coord);
         }
+        NavRoute r;
+        r.distance = vias[i].cost;
+        buildDirections(route, r.directions);
+        routes.push_back(r);
     }
-    
-    if (foundit!=0)
-    {
-        if(! directions.empty()) //this is just for clearing the array.  For later, of course
-            directions.clear();// because we have absolutely no idea if it's actually clear or not
-       
-
-        //Final SHOULDN'T be nullptr, but if it does, you've fucked up
-        
-        GeoSegment firstLast(FINAL->coord, egc);
-        
-        NavSegment thefirst (dirProc(angleOfLine(firstLast)), FINAL->seg.streetName, distanceEarthMiles(FINAL->coord, egc), firstLast); //this will proceed, always, because FIRST SEGMENT;
-        
-        directions.push_back(thefirst);
-        node* cur = FINAL;
+    return NAV_SUCCESS;
+}
 
-        while(cur->parent!=nullptr) //FINAL should not equal nullptr, but if it does
+// Calls f(step, i) for each NavStep of the route in order, i being the route step it ends at.
+// Uses the lengths and angles the route already carries, so there is no trig in here.
+template<typename F>
+void NavigatorImpl::walkSteps(const vector<RouteStep>& route, F f) const
+{
+    for (size_t i = 1; i < route.size(); i++)
+    {
+        size_t street = ml.getStreetId(route[i].segId);
+        if (i > 1 && ml.getStreetId(route[i-1].segId) != street) //you need to turn
         {
-          
-            GeoSegment next(cur->parent->coord, cur->coord);
-            if (cur->parent->seg.streetName==cur->seg.streetName)
-            {
-                 NavSegment straightline (dirProc(angleOfLine(next)), cur->seg.streetName, distanceEarthMiles(cur->parent->coord, cur->coord), next);
-                directions.push_back(straightline);
-            }
-            else //you need to turnnnn
-            {
-                NavSegment turn(dirTurn(angleBetween2Lines(cur->parent->seg.segment, cur->seg.segment)), cur->seg.streetName);
-                NavSegment straightline (dirProc(angleOfLine(next)), cur->seg.streetName, distanceEarthMiles(cur->parent->coord, cur->coord), next);
-                directions.push_back(turn);
-                directions.push_back(straightline);
-            
-            }
-        
+            double angle = route[i].angle - route[i-1].angle; //same as angleBetween2Lines
+            if (angle < 0)
+                angle += 360;
+            NavStep turn;
+            turn.command = NavSegment::TURN;
+            turn.direction = turnDirection(angle);
+            turn.streetId = street;
+            turn.segmentId = route[i].segId;
+            turn.distance = 0;
+            f(turn, i);
         }
-        
-        return NAV_SUCCESS;
-    
+        NavStep proceed;
+        proceed.command = NavSegment::PROCEED;
+        proceed.direction = compassDirection(route[i].angle);
+        proceed.streetId = street;
+        proceed.segmentId = route[i].segId;
+        proceed.distance = route[i].distance;
+        f(proceed, i);
     }
-        
-    return NAV_NO_ROUTE;  // This compiles, but may not be correct
+}
+
+void NavigatorImpl::buildDirections(const vector<RouteStep>& route, vector<NavSegment>& directions) const
+{
+    directions.clear();
+    walkSteps(route, [&](const NavStep& step, size_t i) {
+        const string& street = ml.getStreetName(step.streetId);
+        if (step.command == NavSegment::TURN)
+            directions.push_back(NavSegment(navDirectionText(step.direction), street));
+        else
+            directions.push_back(NavSegment(navDirectionText(step.direction), street, step.distance,
+                                            GeoSegment(route[i-1].coord, route[i].coord)));
+    });
 }
 
     /*vector<StreetSegment> begin = sm.getSegments(sgc);//the very first;
@@ -254,6 +2314,385 @@ NavResult NavigatorImpl::navigate(string start, string end, vector<NavSegment> &
     
  
 
+//******************** RerouteSession *****************************************
+
+// D* Lite (Koenig and Likhachev), searching from the destination back towards the vehicle.
+// g is a node's cost to the destination as last worked out, rhs what its neighbours' g say
+// it should be; the two differ only for nodes in m_open, and keys include the distance from
+// the vehicle, so a search stops as soon as the vehicle's own g can be trusted. A move only
+// adds to m_km (the keys already queued are still lower bounds); a cost change recomputes
+// rhs at the segment's ends, and update carries on from there.
+//
+// The graph is what findRoute searches: segment ends, plus the destination and the
+// vehicle's position where they are partway along a segment.
+class RerouteSessionImpl
+{
+public:
+    RerouteSessionImpl(const NavigatorImpl& nav);
+    NavResult begin(const string& start, const string& end, vector<NavSegment>& directions);
+    bool moveTo(const GeoCoord& gc);
+    bool setSegmentCostFactor(size_t segId, double factor);
+    NavResult update(vector<NavSegment>& directions);
+    double routeCost() const;
+    size_t nodesExpanded() const;
+private:
+    typedef pair<double, double> Key;
+    // On a straight run of segments the heuristic is exactly the cost, and rounding can then
+    // put a node on the route just behind the vehicle in key order, ending the search early
+    static constexpr double HEURISTIC_SCALE = 1 - 1e-6;
+    struct Edge
+    {
+        size_t to;
+        size_t seg;
+        double miles;
+    };
+    struct QueueEntry
+    {
+        Key key;
+        size_t id;
+        bool operator<(const QueueEntry& other) const { return key > other.key; } //smallest key on top
+    };
+    
+    const NavigatorImpl& m_nav;
+    MyMap<GeoCoord, size_t> m_ids;
+    vector<GeoCoord> m_coords;
+    vector<double> m_g, m_rhs;
+    vector<Key> m_queuedKey;
+    vector<bool> m_queued; //entries in m_open for a node that isn't, or with an old key, are skipped
+    priority_queue<QueueEntry> m_open;
+    vector<double> m_factor; //per segment, empty while they're all 1
+    bool m_active;
+    size_t m_start, m_goal, m_last; //m_last: where the vehicle was when m_km was last added to
+    vector<size_t> m_startSegs, m_goalSegs;
+    double m_km;
+    size_t m_expanded;
+    // each node's edges, worked out the first time they're needed; a deque so a reference to
+    // one list stays good while others are added. The factors are applied as they're used,
+    // so only a move (which changes who's special) makes any of these out of date.
+    deque<vector<Edge> > m_adj;
+    vector<bool> m_adjKnown;
+    
+    size_t idOf(const GeoCoord& gc);
+    const vector<Edge>& edges(size_t id);
+    double cost(const Edge& e) const;
+    Key keyOf(size_t id) const;
+    void updateVertex(size_t id);
+    void refresh(size_t id);
+    bool top(Key& key, size_t& id);
+    void computeShortestPath();
+};
+
+RerouteSessionImpl::RerouteSessionImpl(const NavigatorImpl& nav)
+: m_nav(nav), m_active(false), m_start(0), m_goal(0), m_last(0), m_km(0), m_expanded(0)
+{
+}
+
+size_t RerouteSessionImpl::idOf(const GeoCoord& gc)
+{
+    const size_t* known = m_ids.find(gc);
+    if (known != nullptr)
+        return *known;
+    size_t id = m_coords.size();
+    m_ids.associate(gc, id);
+    m_coords.push_back(gc);
+    m_g.push_back(HUGE_VAL);
+    m_rhs.push_back(HUGE_VAL);
+    m_queuedKey.push_back(Key(HUGE_VAL, HUGE_VAL));
+    m_queued.push_back(false);
+    m_adj.push_back(vector<Edge>());
+    m_adjKnown.push_back(false);
+    return id;
+}
+
+// Neighbours have to be symmetric, or a change to one node's g wouldn't reach everything
+// that depends on it. expand adds the destination to the ends of its segments, and here the
+// vehicle's position is added the same way. The other way round, expand also goes to the
+// ends of any segment that has an attraction right where we are, which only the
+// destination and the vehicle may do.
+const vector<RerouteSessionImpl::Edge>& RerouteSessionImpl::edges(size_t id)
+{
+    if (m_adjKnown[id])
+        return m_adj[id];
+    m_adjKnown[id] = true;
+    vector<Edge>& out = m_adj[id];
+    SearchScratch& scratch = searchScratch();
+    GeoCoord here = m_coords[id]; //idOf below may move m_coords
+    m_nav.expand(here, m_coords[m_goal], m_goalSegs, false, scratch);
+    out.clear();
+    bool special = id == m_start || id == m_goal;
+    for (size_t j = 0; j != scratch.next.size(); j++)
+    {
+        const GeoSegment& gs = m_nav.ml.getSegmentRef(scratch.nextSeg[j]).segment;
+        if (! special && ! (here == gs.start) && ! (here == gs.end))
+            continue;
+        Edge e = { idOf(scratch.next[j]), scratch.nextSeg[j], scratch.nextCost[j] };
+        out.push_back(e);
+    }
+    if (id == m_start)
+        return out;
+    const GeoCoord& start = m_coords[m_start];
+    const vector<size_t>& ids = m_nav.sm.getSegmentIds(here);
+    for (size_t i = 0; i != ids.size(); i++)
+    {
+        if (find(m_startSegs.begin(), m_startSegs.end(), ids[i]) == m_startSegs.end())
+            continue;
+        const GeoSegment& gs = m_nav.ml.getSegmentRef(ids[i]).segment;
+        if (start == gs.start || start == gs.end) //then expand has it already
+            continue;
+        Edge e = { m_start, ids[i], distanceEarthMiles(here, start) };
+        out.push_back(e);
+    }
+    return out;
+}
+
+double RerouteSessionImpl::cost(const Edge& e) const
+{
+    if (m_factor.empty() || m_factor[e.seg] == 1)
+        return e.miles;
+    return m_factor[e.seg] == HUGE_VAL ? HUGE_VAL : e.miles * m_factor[e.seg]; //not 0 * HUGE_VAL
+}
+
+RerouteSessionImpl::Key RerouteSessionImpl::keyOf(size_t id) const
+{
+    double m = min(m_g[id], m_rhs[id]);
+    if (m == HUGE_VAL)
+        return Key(HUGE_VAL, HUGE_VAL);
+    return Key(m + HEURISTIC_SCALE * distanceEarthMiles(m_coords[m_start], m_coords[id]) + m_km, m);
+}
+
+void RerouteSessionImpl::updateVertex(size_t id)
+{
+    if (m_g[id] == m_rhs[id])
+    {
+        m_queued[id] = false;
+        return;
+    }
+    Key key = keyOf(id);
+    if (m_queued[id] && m_queuedKey[id] == key)
+        return;
+    m_queued[id] = true;
+    m_queuedKey[id] = key;
+    QueueEntry entry = { key, id };
+    m_open.push(entry);
+}
+
+// rhs from scratch, from the neighbours' g
+void RerouteSessionImpl::refresh(size_t id)
+{
+    if (id == m_goal) //always 0, but its g may need putting back
+    {
+        m_rhs[id] = 0;
+        updateVertex(id);
+        return;
+    }
+    const vector<Edge>& around = edges(id);
+    double best = HUGE_VAL;
+    for (size_t i = 0; i != around.size(); i++)
+        best = min(best, cost(around[i]) + m_g[around[i].to]);
+    m_rhs[id] = best;
+    updateVertex(id);
+}
+
+bool RerouteSessionImpl::top(Key& key, size_t& id)
+{
+    while (! m_open.empty())
+    {
+        const QueueEntry& entry = m_open.top();
+        if (m_queued[entry.id] && m_queuedKey[entry.id] == entry.key)
+        {
+            key = entry.key;
+            id = entry.id;
+            return true;
+        }
+        m_open.pop();
+    }
+    return false;
+}
+
+void RerouteSessionImpl::computeShortestPath()
+{
+    TraceScope trace("reroute search");
+    Key topKey;
+    size_t u;
+    while (true)
+    {
+        bool any = top(topKey, u);
+        if (! (any && topKey < keyOf(m_start)) && m_rhs[m_start] <= m_g[m_start])
+            break;
+        if (! any)
+            break;
+        m_expanded++;
+        Key now = keyOf(u);
+        m_open.pop();
+        m_queued[u] = false;
+        if (topKey < now) //queued before the vehicle moved; back in with what it's worth now
+        {
+            updateVertex(u);
+            continue;
+        }
+        const vector<Edge>& around = edges(u);
+        if (m_g[u] > m_rhs[u])
+        {
+            m_g[u] = m_rhs[u];
+            for (size_t i = 0; i != around.size(); i++)
+            {
+                size_t s = around[i].to;
+                double via = cost(around[i]) + m_g[u];
+                if (s != m_goal && via < m_rhs[s])
+                {
+                    m_rhs[s] = via;
+                    updateVertex(s);
+                }
+            }
+        }
+        else //u got dearer, so anything that went through it has to look again
+        {
+            m_g[u] = HUGE_VAL;
+            refresh(u);
+            for (size_t i = 0; i != around.size(); i++)
+                refresh(around[i].to);
+        }
+    }
+}
+
+NavResult RerouteSessionImpl::begin(const string& start, const string& end, vector<NavSegment>& directions)
+{
+    m_active = false;
+    m_ids.clear();
+    m_coords.clear();
+    m_g.clear();
+    m_rhs.clear();
+    m_queuedKey.clear();
+    m_queued.clear();
+    m_adj.clear();
+    m_adjKnown.clear();
+    m_open = priority_queue<QueueEntry>();
+    m_km = 0;
+    GeoCoord sgc, egc;
+    if (! m_nav.am.getGeoCoord(start, sgc))
+        return NAV_BAD_SOURCE;
+    if (! m_nav.am.getGeoCoord(end, egc))
+        return NAV_BAD_DESTINATION;
+    m_goalSegs = m_nav.sm.getSegmentIds(egc);
+    m_startSegs = m_nav.sm.getSegmentIds(sgc);
+    m_goal = idOf(egc);
+    m_start = m_last = idOf(sgc);
+    m_rhs[m_goal] = 0;
+    updateVertex(m_goal);
+    m_active = true;
+    return update(directions);
+}
+
+bool RerouteSessionImpl::moveTo(const GeoCoord& gc)
+{
+    const vector<size_t>& segs = m_nav.sm.getSegmentIds(gc);
+    if (! m_active || segs.empty())
+        return false;
+    size_t old = m_start;
+    size_t now = idOf(gc);
+    if (now == old)
+        return true;
+    
+    // Edges to a vehicle partway along a segment come and go with it, so the edges of both
+    // positions and of everything on their segments have to be worked out again
+    vector<size_t> changed;
+    changed.push_back(old);
+    changed.push_back(now);
+    changed.push_back(m_goal);
+    for (int which = 0; which != 2; which++)
+    {
+        const vector<size_t>& ids = which == 0 ? m_startSegs : segs;
+        for (size_t i = 0; i != ids.size(); i++)
+        {
+            const GeoSegment& gs = m_nav.ml.getSegmentRef(ids[i]).segment;
+            changed.push_back(idOf(gs.start));
+            changed.push_back(idOf(gs.end));
+        }
+    }
+    m_km += distanceEarthMiles(m_coords[m_last], m_coords[now]);
+    m_last = now;
+    m_start = now;
+    m_startSegs = segs;
+    if (now != m_goal) //the goal's g is 0 however it's reached
+        m_g[now] = HUGE_VAL; //it may have been the vehicle before, and its g went stale while nothing led to it
+    for (size_t i = 0; i != changed.size(); i++)
+    {
+        m_adjKnown[changed[i]] = false;
+        m_adj[changed[i]].clear();
+    }
+    for (size_t i = 0; i != changed.size(); i++)
+        refresh(changed[i]);
+    return true;
+}
+
+bool RerouteSessionImpl::setSegmentCostFactor(size_t segId, double factor)
+{
+    if (segId >= m_nav.ml.getNumSegments() || ! (factor >= 1))
+        return false;
+    if (m_factor.empty())
+        m_factor.assign(m_nav.ml.getNumSegments(), 1);
+    m_factor[segId] = factor;
+    if (! m_active)
+        return true;
+    const GeoSegment& gs = m_nav.ml.getSegmentRef(segId).segment;
+    refresh(idOf(gs.start));
+    refresh(idOf(gs.end));
+    if (find(m_startSegs.begin(), m_startSegs.end(), segId) != m_startSegs.end())
+        refresh(m_start);
+    return true;
+}
+
+NavResult RerouteSessionImpl::update(vector<NavSegment>& directions)
+{
+    TraceScope trace("reroute");
+    m_expanded = 0;
+    directions.clear();
+    if (! m_active)
+        return NAV_BAD_SOURCE;
+    if (! m_nav.sameComponent(m_coords[m_start], m_coords[m_goal]))
+        return NAV_NO_ROUTE;
+    computeShortestPath();
+    if (m_rhs[m_start] == HUGE_VAL) //the search can stop with the vehicle's g still stale, never its rhs
+        return NAV_NO_ROUTE;
+    
+    // downhill in g from the vehicle; visited guards against going round zero-length edges
+    vector<RouteStep> steps(1, m_nav.makeStep(m_coords[m_start], m_coords[m_start], NO_SEGMENT, 0));
+    vector<bool> visited(m_coords.size(), false);
+    for (size_t cur = m_start; cur != m_goal; )
+    {
+        visited[cur] = true;
+        const vector<Edge>& around = edges(cur);
+        const Edge* best = nullptr;
+        double bestCost = HUGE_VAL;
+        for (size_t i = 0; i != around.size(); i++)
+        {
+            const Edge& e = around[i];
+            double c = cost(e) + m_g[e.to];
+            if (e.to < visited.size() && ! visited[e.to] && c < bestCost)
+            {
+                best = &e;
+                bestCost = c;
+            }
+        }
+        if (best == nullptr)
+            return NAV_NO_ROUTE;
+        steps.push_back(m_nav.makeStep(m_coords[cur], m_coords[best->to], best->seg, best->miles));
+        cur = best->to;
+    }
+    m_nav.buildDirections(steps, directions);
+    return NAV_SUCCESS;
+}
+
+double RerouteSessionImpl::routeCost() const
+{
+    return m_active ? m_rhs[m_start] : HUGE_VAL;
+}
+
+size_t RerouteSessionImpl::nodesExpanded() const
+{
+    return m_expanded;
+}
+
 //******************** Navigator functions ************************************
 
 // These functions simply delegate to NavigatorImpl's functions.
@@ -274,7 +2713,198 @@ bool Navigator::loadMapData(string mapFile)
     return m_impl->loadMapData(mapFile);
 }
 
+const char* Navigator::costUnit()
+{
+    return BuildRoute::Metric::unit();
+}
+
 NavResult Navigator::navigate(string start, string end, vector<NavSegment>& directions) const
 {
-    return m_impl->navigate(start, end, directions);
+    return m_impl->navigate(start, end, directions, SearchLimits());
+}
+
+NavResult Navigator::navigate(string start, string end, vector<NavSegment>& directions, NavStats& stats) const
+{
+    return m_impl->navigate(start, end, directions, SearchLimits(), &stats);
+}
+
+NavResult Navigator::navigate(string start, string end, vector<NavSegment>& directions,
+                              NavDeadline deadline, const CancelToken& cancel) const
+{
+    SearchLimits limits;
+    limits.deadline = deadline;
+    limits.cancel = &cancel;
+    return m_impl->navigate(start, end, directions, limits);
+}
+
+future<NavAnswer> Navigator::navigateAsync(string start, string end, NavDeadline deadline, const CancelToken& cancel) const
+{
+    return async(launch::async, [this, start, end, deadline, cancel]() {
+        NavAnswer answer;
+        answer.result = navigate(start, end, answer.directions, deadline, cancel);
+        return answer;
+    });
+}
+
+NavResult Navigator::reachable(string start, double maxDistance, Reachability& result,
+                               NavDeadline deadline, const CancelToken& cancel) const
+{
+    SearchLimits limits;
+    limits.deadline = deadline;
+    limits.cancel = &cancel;
+    return m_impl->reachable(start, maxDistance, result, limits);
+}
+
+NavResult Navigator::alternatives(string start, string end, size_t k, vector<NavRoute>& routes,
+                                  double maxStretch, double maxOverlap, NavDeadline deadline,
+                                  const CancelToken& cancel) const
+{
+    SearchLimits limits;
+    limits.deadline = deadline;
+    limits.cancel = &cancel;
+    return m_impl->alternatives(start, end, k, routes, maxStretch, maxOverlap, limits);
+}
+
+NavResult Navigator::navigateSteps(string start, string end, const NavStepSink& sink,
+                                   NavDeadline deadline, const CancelToken& cancel) const
+{
+    SearchLimits limits;
+    limits.deadline = deadline;
+    limits.cancel = &cancel;
+    return m_impl->navigateSteps(start, end, sink, limits);
+}
+
+NavResult Navigator::navigatePolyline(string start, string end, string& polyline, int precision) const
+{
+    return m_impl->navigatePolyline(start, end, polyline, precision);
+}
+
+const string& Navigator::getStreetName(size_t streetId) const
+{
+    return m_impl->getStreetName(streetId);
+}
+
+size_t Navigator::getNumComponents() const
+{
+    return m_impl->getNumComponents();
+}
+
+vector<ComponentInfo> Navigator::getComponentStats() const
+{
+    return m_impl->getComponentStats();
+}
+
+MemoryUsage Navigator::memoryUsage() const
+{
+    return m_impl->memoryUsage();
+}
+
+vector<Attraction> Navigator::suggestAttractions(string name, size_t k, size_t maxEdits) const
+{
+    return m_impl->suggestAttractions(name, k, maxEdits);
+}
+
+void Navigator::setTurnCosts(const TurnCosts& costs)
+{
+    m_impl->setTurnCosts(costs);
+}
+
+bool Navigator::updateClosures(const vector<SegmentCostChange>& changes)
+{
+    return m_impl->updateClosures(changes);
+}
+
+void Navigator::clearClosures()
+{
+    m_impl->clearClosures();
+}
+
+double Navigator::getSegmentCostFactor(size_t segId) const
+{
+    return m_impl->getSegmentCostFactor(segId);
+}
+
+void Navigator::setRouteCacheCapacity(size_t capacity)
+{
+    m_impl->setRouteCacheCapacity(capacity);
+}
+
+RouteCacheStats Navigator::getRouteCacheStats() const
+{
+    return m_impl->getRouteCacheStats();
+}
+
+void enableNavStats(bool enabled)
+{
+    g_statsEnabled = enabled;
+}
+
+bool navStatsEnabled()
+{
+    return g_statsEnabled;
+}
+
+const NavStats& lastNavStats()
+{
+    return t_lastStats;
+}
+
+NavStatsSummary navStatsSummary()
+{
+    NavStatsSummary summary;
+    summary.queries = g_statsTotals.queries;
+    summary.cacheHits = g_statsTotals.cacheHits;
+    for (int i = 0; i != NavStatsSummary::BUCKETS; i++)
+    {
+        summary.totalMicros[i] = g_statsTotals.totalMicros[i];
+        summary.nodesExpanded[i] = g_statsTotals.nodesExpanded[i];
+    }
+    return summary;
+}
+
+void resetNavStats()
+{
+    g_statsTotals.reset();
+}
+
+//******************** RerouteSession functions *******************************
+
+RerouteSession::RerouteSession(const Navigator& nav)
+{
+    m_impl = new RerouteSessionImpl(*nav.m_impl);
+}
+
+RerouteSession::~RerouteSession()
+{
+    delete m_impl;
+}
+
+NavResult RerouteSession::begin(string start, string end, vector<NavSegment>& directions)
+{
+    return m_impl->begin(start, end, directions);
+}
+
+bool RerouteSession::moveTo(const GeoCoord& gc)
+{
+    return m_impl->moveTo(gc);
+}
+
+bool RerouteSession::setSegmentCostFactor(size_t segId, double factor)
+{
+    return m_impl->setSegmentCostFactor(segId, factor);
+}
+
+NavResult RerouteSession::update(vector<NavSegment>& directions)
+{
+    return m_impl->update(directions);
+}
+
+double RerouteSession::routeCost() const
+{
+    return m_impl->routeCost();
+}
+
+size_t RerouteSession::nodesExpanded() const
+{
+    return m_impl->nodesExpanded();
 }
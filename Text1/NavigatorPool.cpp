@@ -0,0 +1,263 @@
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <atomic>
+using namespace std;
+
+// Each worker owns a queue. Submissions are dealt round-robin across the queues; a worker
+// takes from the front of its own queue and, when that is empty, steals from the back of
+// someone else's, so one slow query doesn't hold up the ones queued behind it. Submitting
+// and taking only lock the one queue involved. The pool-wide mutex is for parking: a worker
+// that finds every queue empty sleeps on m_wake, and a submitter only takes the mutex to
+// wake one if some worker is asleep.
+
+struct NavTask
+{
+    string start;
+    string end;
+    NavDeadline deadline;
+    CancelToken cancel;
+    promise<NavAnswer> answer;
+};
+
+struct WorkQueue
+{
+    mutex m;
+    deque<NavTask*> tasks;
+};
+
+class NavigatorPoolImpl
+{
+public:
+    NavigatorPoolImpl(size_t numThreads);
+    ~NavigatorPoolImpl();
+    bool loadMapData(string mapFile);
+    future<NavAnswer> submit(string start, string end, NavDeadline deadline, const CancelToken& cancel);
+    vector<NavAnswer> navigateAll(const vector<NavQuery>& queries);
+    size_t numThreads() const;
+    const Navigator& navigator() const;
+    bool updateClosures(const vector<SegmentCostChange>& changes);
+private:
+    Navigator m_nav; //the only copy of the map
+    vector<unique_ptr<WorkQueue> > m_queues;
+    vector<thread> m_workers;
+    
+    // Counted before the task goes in a queue and after it comes out, so it's never less
+    // than what the queues hold
+    atomic<size_t> m_queued;
+    atomic<size_t> m_inFlight; //submitted but not yet answered
+    atomic<size_t> m_nextQueue;
+    atomic<size_t> m_sleeping; //workers parked on m_wake, or about to be
+    atomic<bool> m_stopping;
+    
+    mutex m_mutex; //for parking workers and waiting on m_idle; guards nothing else
+    condition_variable m_wake;
+    condition_variable m_idle;
+    
+    void workerLoop(size_t me);
+    NavTask* takeTask(size_t me);
+};
+
+NavigatorPoolImpl::NavigatorPoolImpl(size_t numThreads)
+: m_queued(0), m_inFlight(0), m_nextQueue(0), m_sleeping(0), m_stopping(false)
+{
+    if (numThreads == 0)
+        numThreads = thread::hardware_concurrency();
+    if (numThreads == 0) //hardware_concurrency may not know
+        numThreads = 1;
+    for (size_t i = 0; i != numThreads; i++)
+        m_queues.push_back(unique_ptr<WorkQueue>(new WorkQueue));
+    for (size_t i = 0; i != numThreads; i++)
+        m_workers.push_back(thread(&NavigatorPoolImpl::workerLoop, this, i));
+}
+
+NavigatorPoolImpl::~NavigatorPoolImpl()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i != m_workers.size(); i++)
+        m_workers[i].join();
+}
+
+bool NavigatorPoolImpl::loadMapData(string mapFile)
+{
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]{ return m_inFlight == 0; });
+    }
+    return m_nav.loadMapData(mapFile);
+}
+
+future<NavAnswer> NavigatorPoolImpl::submit(string start, string end, NavDeadline deadline, const CancelToken& cancel)
+{
+    NavTask* task = new NavTask;
+    task->start = start;
+    task->end = end;
+    task->deadline = deadline;
+    task->cancel = cancel;
+    future<NavAnswer> result = task->answer.get_future();
+    
+    m_inFlight++;
+    m_queued++; //before the task can be taken, so a worker can't count it out first
+    size_t q = m_nextQueue++ % m_queues.size();
+    {
+        lock_guard<mutex> lock(m_queues[q]->m);
+        m_queues[q]->tasks.push_back(task);
+    }
+    if (m_sleeping > 0)
+    {
+        lock_guard<mutex> lock(m_mutex); //a worker going to sleep holds this until it's waiting
+        m_wake.notify_one();
+    }
+    return result;
+}
+
+vector<NavAnswer> NavigatorPoolImpl::navigateAll(const vector<NavQuery>& queries)
+{
+    vector<future<NavAnswer> > futures;
+    for (size_t i = 0; i != queries.size(); i++)
+        futures.push_back(submit(queries[i].start, queries[i].end, NavDeadline::max(), CancelToken()));
+    vector<NavAnswer> answers;
+    for (size_t i = 0; i != futures.size(); i++)
+        answers.push_back(futures[i].get());
+    return answers;
+}
+
+size_t NavigatorPoolImpl::numThreads() const
+{
+    return m_workers.size();
+}
+
+const Navigator& NavigatorPoolImpl::navigator() const
+{
+    return m_nav;
+}
+
+bool NavigatorPoolImpl::updateClosures(const vector<SegmentCostChange>& changes)
+{
+    return m_nav.updateClosures(changes); //queries already running keep the overlay they started with
+}
+
+NavTask* NavigatorPoolImpl::takeTask(size_t me)
+{
+    {
+        WorkQueue& own = *m_queues[me];
+        lock_guard<mutex> lock(own.m);
+        if (! own.tasks.empty())
+        {
+            NavTask* t = own.tasks.front();
+            own.tasks.pop_front();
+            return t;
+        }
+    }
+    for (size_t i = 1; i != m_queues.size(); i++)
+    {
+        WorkQueue& victim = *m_queues[(me + i) % m_queues.size()];
+        lock_guard<mutex> lock(victim.m);
+        if (! victim.tasks.empty())
+        {
+            NavTask* t = victim.tasks.back();
+            victim.tasks.pop_back();
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+void NavigatorPoolImpl::workerLoop(size_t me)
+{
+    for (;;)
+    {
+        NavTask* task = takeTask(me);
+        if (task == nullptr)
+        {
+            if (m_stopping && m_queued == 0)
+                return;
+            // Either we see the task counted in m_queued, or its submitter sees us in m_sleeping
+            // and has to get m_mutex to wake us, which it can't until we're waiting
+            unique_lock<mutex> lock(m_mutex);
+            m_sleeping++;
+            m_wake.wait(lock, [this]{ return m_stopping || m_queued > 0; });
+            m_sleeping--;
+            lock.unlock();
+            this_thread::yield(); //in case it's counted but not in its queue quite yet
+            continue;
+        }
+        m_queued--;
+        
+        NavAnswer answer;
+        if (task->cancel.cancelled())
+            answer.result = NAV_CANCELLED;
+        else if (chrono::steady_clock::now() >= task->deadline) //expired while it sat in the queue
+            answer.result = NAV_TIMEOUT;
+        else
+            answer.result = m_nav.navigate(task->start, task->end, answer.directions, task->deadline, task->cancel);
+        task->answer.set_value(answer);
+        delete task;
+        
+        if (--m_inFlight == 0)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_idle.notify_all();
+        }
+    }
+}
+
+//******************** NavigatorPool functions ********************************
+
+// These functions simply delegate to NavigatorPoolImpl's functions.
+
+NavigatorPool::NavigatorPool(size_t numThreads)
+{
+    m_impl = new NavigatorPoolImpl(numThreads);
+}
+
+NavigatorPool::~NavigatorPool()
+{
+    delete m_impl;
+}
+
+bool NavigatorPool::loadMapData(string mapFile)
+{
+    return m_impl->loadMapData(mapFile);
+}
+
+future<NavAnswer> NavigatorPool::submit(string start, string end)
+{
+    return m_impl->submit(start, end, NavDeadline::max(), CancelToken());
+}
+
+future<NavAnswer> NavigatorPool::submit(string start, string end, NavDeadline deadline, const CancelToken& cancel)
+{
+    return m_impl->submit(start, end, deadline, cancel);
+}
+
+vector<NavAnswer> NavigatorPool::navigateAll(const vector<NavQuery>& queries)
+{
+    return m_impl->navigateAll(queries);
+}
+
+size_t NavigatorPool::numThreads() const
+{
+    return m_impl->numThreads();
+}
+
+const Navigator& NavigatorPool::navigator() const
+{
+    return m_impl->navigator();
+}
+
+bool NavigatorPool::updateClosures(const vector<SegmentCostChange>& changes)
+{
+    return m_impl->updateClosures(changes);
+}
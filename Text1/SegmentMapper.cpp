@@ -1,6 +1,7 @@
 #include "provided.h"
 #include <vector>
 #include "MyMap.h"
+#include "support.h"
 using namespace std;
 
 class SegmentMapperImpl
@@ -10,134 +11,83 @@ public:
     ~SegmentMapperImpl();
     void init(const MapLoader& ml);
     vector<StreetSegment> getSegments(const GeoCoord& gc) const;
+    const vector<size_t>& getSegmentIds(const GeoCoord& gc) const;
+    void addMemoryUsage(MemoryUsage& usage) const;
 private:
-    MyMap<GeoCoord, vector<StreetSegment> > m_map;
-
+    MemoryCounter m_indexMem;
+    // Each coordinate maps to the IDs of the segments touching it; the segments themselves
+    // stay in the MapLoader, which getSegments copies them out of.
+    MyMap<GeoCoord, vector<size_t> > m_map;
+    const MapLoader* m_ml;
+    
+    void addId(const GeoCoord& gc, size_t id);
 };
 
 SegmentMapperImpl::SegmentMapperImpl()
+: m_ml(nullptr)
+{
+    m_map.trackWith(&m_indexMem);
+}
+
+void SegmentMapperImpl::addMemoryUsage(MemoryUsage& usage) const
 {
+    usage.segmentIndex += m_indexMem.bytes;
+    m_map.forEach([&usage](const GeoCoord& gc, const vector<size_t>& ids) {
+        usage.segmentIndex += heapBytes(gc) + ids.capacity() * sizeof(size_t);
+    });
 }
 
 SegmentMapperImpl::~SegmentMapperImpl()
 {
 }
 
-void SegmentMapperImpl::init(const MapLoader& ml)
+void SegmentMapperImpl::addId(const GeoCoord& gc, size_t id)
 {
-    for(int i=0; i!= ml.getNumSegments(); i++)
+    vector<size_t>* ids = m_map.find(gc);
+    if (ids == nullptr)
     {
-        StreetSegment seg;
-        ml.getSegment(i, seg);
-        GeoCoord end = seg.segment.end;
-        GeoCoord start = seg.segment.start;
-        
-        
-        int problemA =0;
-        vector<StreetSegment> tempA = getSegments(start); //herrreeee
-        for (int a = 0; a!=tempA.size(); a++)
-        {
-            if (tempA[a].streetName == seg.streetName)
-                problemA++;
-        }
-        if (problemA==0)
-            tempA.push_back(seg);
-        m_map.associate(start, tempA); //does this not do anything?
-        
-        
-        int problemB =0;
-        vector<StreetSegment> tempB = getSegments(end);
-        for (int a = 0; a!=tempB.size(); a++)
-        {
-            if (tempB[a].streetName == seg.streetName)
-                problemB++;
-        }
-        if (problemB==0)
-            tempB.push_back(seg);
-        m_map.associate(end, tempB);
-        
-        
-        for (int j = 0; j!= seg.attractions.size(); j++)
-        {
-            int problemC=0;
-            vector<StreetSegment> tempC = getSegments(seg.attractions[j].geocoordinates);
-            for (int a = 0; a!=tempC.size(); a++)
-            {
-                if (tempC[a].streetName == seg.streetName)
-                    problemC++;
-            }
-            if (problemC==0)
-                tempC.push_back(seg);
-            m_map.associate(seg.attractions[j].geocoordinates, tempC);
-            
-            
-        }
-        
-        
-        /*
-        
-    
-   
-       vector<StreetSegment>* tempA = m_map.find(start); ///this is just for the start
-        if (tempA == nullptr)
-        {
-            vector<StreetSegment> tempA1;
-            tempA1.push_back(seg);
-            m_map.associate(start, tempA1);
-        }
-        else
-        {
-                tempA->push_back(seg);
-            
-        }
-        
-        vector<StreetSegment>* tempB = m_map.find(end); ///this is for the end
-        if (tempB == nullptr)
-        {
-            vector<StreetSegment> tempB1;
-            tempB1.push_back(seg);
-            m_map.associate(start, tempB1);
-        }
-        else
-            tempB->push_back(seg);
-        
-        
-        for (int j = 0; j!= seg.attractions.size(); j++)
-        {
-            vector<StreetSegment>* tempC = m_map.find(seg.attractions[j].geocoordinates);
-            if (tempC == nullptr)
-            {
-                vector<StreetSegment> tempC1;
-                tempC1.push_back(seg);
-                m_map.associate(seg.attractions[j].geocoordinates, tempC1);
-            }
-            else
-                tempC->push_back(seg);
-            
-        }
-        */
-        
-     
+        m_map.associate(gc, vector<size_t>(1, id));
+        return;
     }
-    
+    for (size_t i = 0; i != ids->size(); i++)
+    {
+        if ((*ids)[i] == id) //e.g. an attraction sitting right on an endpoint
+            return;
+    }
+    ids->push_back(id);
 }
 
-vector<StreetSegment> SegmentMapperImpl::getSegments(const GeoCoord& gc) const
+void SegmentMapperImpl::init(const MapLoader& ml)
 {
-    
-    if (m_map.find(gc)==nullptr)
+    TraceScope trace("SegmentMapper::init");
+    m_map.clear(); //init may be called again when the map is reloaded
+    m_ml = &ml;
+    for(size_t i=0; i!= ml.getNumSegments(); i++)
     {
-        vector<StreetSegment> temp;
-        return temp;
+        const StreetSegment& seg = ml.getSegmentRef(i);
+        addId(seg.segment.start, i);
+        addId(seg.segment.end, i);
+        for (size_t j = 0; j!= seg.attractions.size(); j++)
+            addId(seg.attractions[j].geocoordinates, i);
     }
-    
-    vector<StreetSegment> vec = *m_map.find(gc);
+}
+
+vector<StreetSegment> SegmentMapperImpl::getSegments(const GeoCoord& gc) const
+{
+    const vector<size_t>& ids = getSegmentIds(gc);
+    vector<StreetSegment> vec;
+    for (size_t i = 0; i != ids.size(); i++)
+        vec.push_back(m_ml->getSegmentRef(ids[i]));
     return vec;
-    
-    
-    //vector<StreetSegment> segments;
-    //return segments;  // This compiles, but may not be correct
-  
+}
+
+const vector<size_t>& SegmentMapperImpl::getSegmentIds(const GeoCoord& gc) const
+{
+    static const vector<size_t> none;
+    const vector<size_t>* ids = m_map.find(gc);
+    if (ids == nullptr)
+        return none;
+    return *ids;
 }
 
 //******************** SegmentMapper functions ********************************
@@ -164,3 +114,13 @@ vector<StreetSegment> SegmentMapper::getSegments(const GeoCoord& gc) const
 {
     return m_impl->getSegments(gc);
 }
+
+const vector<size_t>& SegmentMapper::getSegmentIds(const GeoCoord& gc) const
+{
+    return m_impl->getSegmentIds(gc);
+}
+
+void SegmentMapper::addMemoryUsage(MemoryUsage& usage) const
+{
+    m_impl->addMemoryUsage(usage);
+}
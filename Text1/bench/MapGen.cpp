@@ -0,0 +1,472 @@
+//
+//  MapGen.cpp
+//  Writes synthetic maps in the format MapLoader reads, for benchmarks and stress tests:
+//  grid, radial (rings and spokes) or random planar street networks, optionally split into
+//  disconnected islands, with attractions sprinkled along the segments.
+//
+//  Every random choice is a hash of the seed and where it's being made, not a draw from a
+//  running generator, so the output depends only on the options - not on the thread count -
+//  and each thread can write its own cells of the map without talking to the others.
+//
+//  The cells go out in a shuffled order rather than row by row. MapLoader's users index the
+//  segments in MyMaps keyed by coordinate, and those unbalanced trees go quadratic when
+//  the keys arrive sorted, which would make a big generated map take hours to load.
+//
+//  Build from Text1/bench (it needs nothing else from Text1):
+//    g++ -std=c++11 -O2 -pthread -o mapgen MapGen.cpp
+//
+//  Usage:
+//    mapgen [--type grid|radial|planar] [--segments N] [--attractions PER_SEGMENT]
+//           [--islands K] [--seed S] [--threads T] [-o map.txt]
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+using namespace std;
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+// Where the maps are put, and how far apart neighbouring corners are (about 100m)
+const double BASE_LAT = 34.05, BASE_LON = -118.25;
+const double SPACING = 0.001;
+
+const char* const WORDS[] = {
+    "Oak", "Maple", "Pine", "Cedar", "Elm", "Willow", "Birch", "Walnut", "Cherry", "Spruce",
+    "Sunset", "Highland", "Lake", "River", "Hill", "Park", "Valley", "Mission", "Spring", "Summit",
+    "Washington", "Lincoln", "Jefferson", "Madison", "Franklin", "Jackson", "Grant", "Adams", "Monroe", "Wilson",
+    "Harbor", "Canyon", "Mesa", "Vista", "Ocean", "Meadow", "Orchard", "Forest", "Garden", "Bay",
+    "Colorado", "Vermont", "Alvarado", "Figueroa", "Olive", "Flower", "Hope", "Grand", "Broadway", "Main",
+};
+const size_t NUM_WORDS = sizeof(WORDS) / sizeof(WORDS[0]);
+const char* const SUFFIXES[] = { "Street", "Avenue", "Boulevard", "Road", "Drive", "Lane", "Way", "Place" };
+const size_t NUM_SUFFIXES = sizeof(SUFFIXES) / sizeof(SUFFIXES[0]);
+const char* const KINDS[] = {
+    "Cafe", "Museum", "Library", "Theater", "Market", "Bakery", "School", "Gallery", "Hotel", "Station",
+    "Pharmacy", "Diner", "Bookstore", "Gym", "Clinic", "Bank",
+};
+const size_t NUM_KINDS = sizeof(KINDS) / sizeof(KINDS[0]);
+
+enum MapType { GRID, RADIAL, PLANAR };
+
+struct Options
+{
+    MapType type = GRID;
+    unsigned long long segments = 100000;
+    double attractions = 0.02; //average per segment
+    unsigned islands = 1;
+    unsigned long long seed = 1;
+    unsigned threads = 0;
+    string out;
+};
+
+// splitmix64 finalizer over everything that identifies the choice being made
+unsigned long long mix(unsigned long long x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+unsigned long long hash4(unsigned long long seed, unsigned long long a, unsigned long long b, unsigned long long c)
+{
+    return mix(mix(mix(mix(seed) ^ a) ^ b) ^ c);
+}
+
+double unit(unsigned long long h) //[0, 1)
+{
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// A fixed shuffle of 0..n-1: a four-round Feistel network over the next power of four up,
+// applied again to anything that lands past n (which keeps it one-to-one)
+class Shuffle
+{
+public:
+    Shuffle(unsigned long long n, unsigned long long seed)
+    : m_n(n), m_seed(seed), m_halfBits(1)
+    {
+        while (m_halfBits < 31 && (1ULL << (2 * m_halfBits)) < n)
+            m_halfBits++;
+    }
+    
+    unsigned long long operator()(unsigned long long i) const
+    {
+        do
+            i = permute(i);
+        while (i >= m_n);
+        return i;
+    }
+private:
+    unsigned long long m_n, m_seed;
+    unsigned m_halfBits;
+    
+    unsigned long long permute(unsigned long long x) const
+    {
+        unsigned long long mask = (1ULL << m_halfBits) - 1;
+        unsigned long long left = x >> m_halfBits, right = x & mask;
+        for (unsigned long long round = 0; round != 4; round++)
+        {
+            unsigned long long next = left ^ (hash4(m_seed, right, 32 + round, 0) & mask);
+            left = right;
+            right = next;
+        }
+        return (left << m_halfBits) | right;
+    }
+};
+
+struct Point
+{
+    double lat, lon;
+};
+
+// Text output without printf: coordinates are written as fixed six-decimal numbers
+class Writer
+{
+public:
+    Writer(string& out)
+    : m_out(out)
+    {}
+    
+    void text(const char* s)
+    {
+        m_out.append(s);
+    }
+    void text(const string& s)
+    {
+        m_out.append(s);
+    }
+    void ch(char c)
+    {
+        m_out.push_back(c);
+    }
+    void number(unsigned long long n)
+    {
+        char buf[24];
+        int i = 24;
+        do
+        {
+            buf[--i] = char('0' + n % 10);
+            n /= 10;
+        } while (n != 0);
+        m_out.append(buf + i, 24 - i);
+    }
+    void degrees(double d)
+    {
+        long long micro = llround(d * 1e6);
+        if (micro < 0)
+        {
+            ch('-');
+            micro = -micro;
+        }
+        number(micro / 1000000);
+        ch('.');
+        char frac[6];
+        long long f = micro % 1000000;
+        for (int i = 5; i >= 0; i--)
+        {
+            frac[i] = char('0' + f % 10);
+            f /= 10;
+        }
+        m_out.append(frac, 6);
+    }
+private:
+    string& m_out;
+};
+
+// Everything one island needs to lay out and name its streets. Work is handed out in
+// cells, a corner of a grid or planar map or a spoke and ring of a radial one; writeCell
+// writes every segment belonging to one.
+class Island
+{
+public:
+    Island(const Options& opt, unsigned index, unsigned long long segments)
+    : m_opt(opt), m_index(index)
+    {
+        if (opt.type == RADIAL)
+        {
+            // spokes S and rings K give S*K spoke segments plus S*K ring segments
+            m_rows = max<unsigned long long>(3, (unsigned long long)sqrt(segments / 2.0));
+            m_cols = max<unsigned long long>(1, segments / (2 * m_rows));
+        }
+        else
+        {
+            // an R x C grid has R*(C-1) + C*(R-1) segments, about 2*R*C
+            m_rows = max<unsigned long long>(2, (unsigned long long)sqrt(segments / 2.0));
+            m_cols = max<unsigned long long>(2, segments / (2 * m_rows) + 1);
+        }
+        // islands side by side from west to east, a few blocks of sea between them
+        double width = opt.type == RADIAL ? 2 * m_cols * SPACING : m_cols * SPACING;
+        m_origin.lat = BASE_LAT;
+        m_origin.lon = BASE_LON + index * (width + 5 * SPACING);
+    }
+    
+    unsigned long long cells() const
+    {
+        return m_rows * m_cols;
+    }
+    
+    void writeCell(unsigned long long cell, string& out) const
+    {
+        Writer w(out);
+        unsigned long long r = cell / m_cols, c = cell % m_cols;
+        if (m_opt.type == RADIAL)
+        {
+            segment(w, spokeName(r), radialPoint(r, c), radialPoint(r, c + 1), r, c, 0);
+            segment(w, ringName(c + 1), radialPoint(r, c + 1), radialPoint((r + 1) % m_rows, c + 1), r, c, 1);
+            return;
+        }
+        if (c + 1 != m_cols && keep(r, c, 0))
+            segment(w, rowName(r), gridPoint(r, c), gridPoint(r, c + 1), r, c, 0);
+        if (r + 1 != m_rows && keep(r, c, 1))
+            segment(w, columnName(c), gridPoint(r, c), gridPoint(r + 1, c), r, c, 1);
+        // a planar map also gets one diagonal in some cells; one per cell can't cross another
+        if (m_opt.type == PLANAR && r + 1 != m_rows && c + 1 != m_cols
+            && unit(hash4(m_opt.seed, key(r, c), 2, 0)) < 0.3)
+        {
+            bool down = hash4(m_opt.seed, key(r, c), 3, 0) & 1;
+            segment(w, diagonalName(r, c), gridPoint(r + (down ? 0 : 1), c), gridPoint(r + (down ? 1 : 0), c + 1), r, c, 2);
+        }
+    }
+private:
+    const Options& m_opt;
+    unsigned m_index;
+    unsigned long long m_rows, m_cols;
+    Point m_origin;
+    
+    unsigned long long key(unsigned long long r, unsigned long long c) const
+    {
+        return (((unsigned long long)m_index << 48) ^ (r << 24)) ^ c;
+    }
+    
+    // Planar maps drop a few grid edges; a grid keeps them all
+    bool keep(unsigned long long r, unsigned long long c, int dir) const
+    {
+        return m_opt.type != PLANAR || unit(hash4(m_opt.seed, key(r, c), 4 + dir, 0)) >= 0.1;
+    }
+    
+    Point gridPoint(unsigned long long r, unsigned long long c) const
+    {
+        Point p;
+        p.lat = m_origin.lat + r * SPACING;
+        p.lon = m_origin.lon + c * SPACING;
+        if (m_opt.type == PLANAR) //wobble each corner by up to a quarter block
+        {
+            unsigned long long h = hash4(m_opt.seed, key(r, c), 1, 0);
+            p.lat += (unit(h) - 0.5) * 0.5 * SPACING;
+            p.lon += (unit(mix(h)) - 0.5) * 0.5 * SPACING;
+        }
+        return p;
+    }
+    
+    // Spoke s of m_rows, ring k of m_cols (ring 0 is the centre)
+    Point radialPoint(unsigned long long s, unsigned long long k) const
+    {
+        double angle = 2 * PI * s / m_rows;
+        double radius = k * SPACING;
+        Point p;
+        p.lat = m_origin.lat + m_cols * SPACING + radius * sin(angle);
+        p.lon = m_origin.lon + m_cols * SPACING + radius * cos(angle);
+        if (k == 0) //every spoke starts at exactly the same centre
+        {
+            p.lat = m_origin.lat + m_cols * SPACING;
+            p.lon = m_origin.lon + m_cols * SPACING;
+        }
+        return p;
+    }
+    
+    // One name per street, kept along its whole length; the pool of word and suffix pairs
+    // is reused every 400 streets, as towns reuse the same few dozen names
+    string rowName(unsigned long long r) const
+    {
+        unsigned long long h = mix(r % (NUM_WORDS * NUM_SUFFIXES) + 1);
+        return string(WORDS[h % NUM_WORDS]) + " " + SUFFIXES[(h / NUM_WORDS) % NUM_SUFFIXES];
+    }
+    
+    string columnName(unsigned long long c) const
+    {
+        unsigned long long n = c % 200 + 1;
+        const char* th = (n % 100 >= 11 && n % 100 <= 13) ? "th" : n % 10 == 1 ? "st" : n % 10 == 2 ? "nd" : n % 10 == 3 ? "rd" : "th";
+        return to_string(n) + th + " Street";
+    }
+    
+    string diagonalName(unsigned long long r, unsigned long long c) const
+    {
+        return string(WORDS[mix(key(r, c)) % NUM_WORDS]) + " Cut";
+    }
+    
+    string spokeName(unsigned long long s) const
+    {
+        return string(WORDS[s % NUM_WORDS]) + " Boulevard";
+    }
+    
+    string ringName(unsigned long long k) const
+    {
+        return "Ring Road " + to_string(k);
+    }
+    
+    void segment(Writer& w, const string& name, const Point& a, const Point& b,
+                 unsigned long long r, unsigned long long c, int dir) const
+    {
+        w.text(name);
+        w.ch('\n');
+        w.degrees(a.lat);
+        w.text(", ");
+        w.degrees(a.lon);
+        w.ch(' ');
+        w.degrees(b.lat);
+        w.ch(',');
+        w.degrees(b.lon);
+        w.ch('\n');
+        
+        // how many attractions: the whole part of the density, plus one more with the
+        // probability of the fractional part
+        unsigned long long h = hash4(m_opt.seed, key(r, c), 8 + dir, 0);
+        unsigned long long count = (unsigned long long)m_opt.attractions;
+        if (unit(h) < m_opt.attractions - count)
+            count++;
+        w.number(count);
+        w.ch('\n');
+        for (unsigned long long i = 0; i != count; i++)
+        {
+            unsigned long long ha = hash4(m_opt.seed, key(r, c), 16 + dir, i);
+            double t = unit(ha);
+            // unique names: the segment's position and the attraction's number along it
+            w.text(WORDS[ha % NUM_WORDS]);
+            w.ch(' ');
+            w.text(KINDS[(ha >> 8) % NUM_KINDS]);
+            w.ch(' ');
+            w.number(m_index);
+            w.ch('-');
+            w.number(r);
+            w.ch('-');
+            w.number(c);
+            w.ch('-');
+            w.number(dir * 1000 + i);
+            w.ch('|');
+            w.degrees(a.lat + t * (b.lat - a.lat));
+            w.text(", ");
+            w.degrees(a.lon + t * (b.lon - a.lon));
+            w.ch('\n');
+        }
+    }
+};
+
+void usage()
+{
+    cerr << "usage: mapgen [--type grid|radial|planar] [--segments N] [--attractions PER_SEGMENT]" << endl
+         << "              [--islands K] [--seed S] [--threads T] [-o map.txt]" << endl;
+}
+
+bool parse(int argc, char* argv[], Options& opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+        string value = argv[++i];
+        if (arg == "--type")
+        {
+            if (value == "grid")
+                opt.type = GRID;
+            else if (value == "radial")
+                opt.type = RADIAL;
+            else if (value == "planar")
+                opt.type = PLANAR;
+            else
+                return false;
+        }
+        else if (arg == "--segments")
+            opt.segments = strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--attractions")
+            opt.attractions = atof(value.c_str());
+        else if (arg == "--islands")
+            opt.islands = unsigned(atoi(value.c_str()));
+        else if (arg == "--seed")
+            opt.seed = strtoull(value.c_str(), nullptr, 10);
+        else if (arg == "--threads")
+            opt.threads = unsigned(atoi(value.c_str()));
+        else if (arg == "-o")
+            opt.out = value;
+        else
+            return false;
+    }
+    return opt.segments > 0 && opt.islands > 0 && opt.attractions >= 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options opt;
+    if (! parse(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+    unsigned threads = opt.threads != 0 ? opt.threads : max(1u, thread::hardware_concurrency());
+    
+    FILE* out = opt.out.empty() ? stdout : fopen(opt.out.c_str(), "wb");
+    if (out == nullptr)
+    {
+        cerr << "mapgen: can't write " << opt.out << endl;
+        return 1;
+    }
+    
+    // Every island is the same size, so cell g of the whole map is cell g % cells of island
+    // g / cells. Cells are written a batch at a time, in shuffled order: each thread fills its
+    // share of the batch's buffers, then they go out in order while nothing else is running.
+    vector<Island> islands;
+    for (unsigned island = 0; island != opt.islands; island++)
+        islands.push_back(Island(opt, island, opt.segments / opt.islands));
+    unsigned long long cellsPerIsland = islands[0].cells();
+    unsigned long long cells = cellsPerIsland * opt.islands;
+    Shuffle order(cells, opt.seed);
+    const unsigned long long CELLS_PER_BUFFER = 1024;
+    vector<string> buffers(threads * 4);
+    for (unsigned long long batch = 0; batch < cells; batch += buffers.size() * CELLS_PER_BUFFER)
+    {
+        vector<thread> workers;
+        for (unsigned t = 0; t != threads; t++)
+        {
+            workers.push_back(thread([&, t]() {
+                for (size_t b = t; b < buffers.size(); b += threads)
+                {
+                    buffers[b].clear();
+                    unsigned long long first = batch + b * CELLS_PER_BUFFER;
+                    for (unsigned long long i = first; i < min(cells, first + CELLS_PER_BUFFER); i++)
+                    {
+                        unsigned long long g = order(i);
+                        islands[g / cellsPerIsland].writeCell(g % cellsPerIsland, buffers[b]);
+                    }
+                }
+            }));
+        }
+        for (unsigned t = 0; t != threads; t++)
+            workers[t].join();
+        for (size_t b = 0; b != buffers.size(); b++)
+        {
+            if (fwrite(buffers[b].data(), 1, buffers[b].size(), out) != buffers[b].size())
+            {
+                cerr << "mapgen: write failed" << endl;
+                return 1;
+            }
+        }
+    }
+    if (out != stdout && fclose(out) != 0)
+    {
+        cerr << "mapgen: write failed" << endl;
+        return 1;
+    }
+    return 0;
+}
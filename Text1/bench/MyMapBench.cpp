@@ -0,0 +1,341 @@
+//
+//  MyMapBench.cpp
+//  Micro-benchmarks for MyMap with int, string and GeoCoord keys: associate, find of keys
+//  that are there, find of keys that aren't, and clear, for keys arriving sorted, reverse
+//  sorted, shuffled, or in shuffled runs of consecutive keys ("clustered"). Reports ns per
+//  operation, hardware cache misses per operation where perf events are available, and
+//  the height of the tree each order builds, as JSON.
+//
+//  MyMap doesn't balance itself, so sorted and reverse orders build a chain and cost
+//  O(n) per operation; they're only run up to --max-degenerate keys.
+//
+//  Build from Text1/bench:
+//    g++ -std=c++11 -O2 -pthread -I.. -o mymapbench MyMapBench.cpp ../support.cpp
+//
+//  Usage:
+//    mymapbench [--max-size N] [--max-degenerate N] [--seed S] [--out results.json]
+//
+
+#include "provided.h"
+#include "support.h"
+#include "MyMap.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+// Last-level cache misses for this thread, from the kernel's perf events. Many VMs and
+// containers don't allow them, in which case available() is false and misses are reported as null.
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    : m_fd(-1)
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+    
+    bool available() const
+    {
+        return m_fd >= 0;
+    }
+    
+    void start()
+    {
+#ifdef __linux__
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+    
+    long long stop()
+    {
+        long long count = 0;
+#ifdef __linux__
+        if (m_fd >= 0)
+        {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+                count = 0;
+        }
+#endif
+        return count;
+    }
+private:
+    int m_fd;
+};
+
+// Keys are made from even numbers, so the odd numbers between them are misses that land
+// all over the tree rather than off either end.
+int makeKey(int n, int)
+{
+    return n;
+}
+
+string makeKey(int n, const string&)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "key%09d", n); //zero padded, so string order is number order
+    return buf;
+}
+
+GeoCoord makeKey(int n, const GeoCoord&)
+{
+    // a 4096-wide grid of points 0.0001 degrees apart, in row order
+    char lat[32], lon[32];
+    snprintf(lat, sizeof(lat), "%.6f", 34.0 + (n / 4096) * 0.0001);
+    snprintf(lon, sizeof(lon), "%.6f", -118.0 + (n % 4096) * 0.0001);
+    return GeoCoord(lat, lon);
+}
+
+// The order the numbers 0..n-1 are inserted in
+vector<int> insertionOrder(const string& order, int n, mt19937& rng)
+{
+    vector<int> idx(n);
+    for (int i = 0; i != n; i++)
+        idx[i] = i;
+    if (order == "reverse")
+        reverse(idx.begin(), idx.end());
+    else if (order == "random")
+        shuffle(idx.begin(), idx.end(), rng);
+    else if (order == "clustered") //runs of 64 consecutive keys, the runs shuffled
+    {
+        const int RUN = 64;
+        vector<int> runs((n + RUN - 1) / RUN);
+        for (size_t r = 0; r != runs.size(); r++)
+            runs[r] = int(r);
+        shuffle(runs.begin(), runs.end(), rng);
+        idx.clear();
+        for (size_t r = 0; r != runs.size(); r++)
+            for (int i = runs[r] * RUN; i != min(n, (runs[r] + 1) * RUN); i++)
+                idx.push_back(i);
+    }
+    return idx;
+}
+
+struct Phase
+{
+    double nsPerOp;
+    double missesPerOp; //negative if unavailable
+};
+
+struct CaseResult
+{
+    string keyType, order, op;
+    int size;
+    Phase phase;
+    int height;
+};
+
+template<typename F>
+Phase timePhase(CacheMissCounter& misses, size_t ops, F f)
+{
+    misses.start();
+    Clock::time_point start = Clock::now();
+    f();
+    double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+    long long m = misses.stop();
+    Phase p;
+    p.nsPerOp = ns / ops;
+    p.missesPerOp = misses.available() ? double(m) / ops : -1;
+    return p;
+}
+
+volatile long long g_sink; //so the finds can't be optimized away
+
+template<typename K>
+void benchKey(const string& keyType, const string& order, int n, mt19937& rng, CacheMissCounter& misses,
+              vector<CaseResult>& results)
+{
+    vector<int> order0 = insertionOrder(order, n, rng);
+    vector<K> inserted, hits, absent;
+    inserted.reserve(n);
+    for (int i = 0; i != n; i++)
+        inserted.push_back(makeKey(2 * order0[i], K()));
+    vector<int> probe(n);
+    for (int i = 0; i != n; i++)
+        probe[i] = i;
+    shuffle(probe.begin(), probe.end(), rng);
+    hits.reserve(n);
+    absent.reserve(n);
+    for (int i = 0; i != n; i++)
+    {
+        hits.push_back(makeKey(2 * probe[i], K()));
+        absent.push_back(makeKey(2 * probe[i] + 1, K()));
+    }
+    
+    MyMap<K, int>* map = new MyMap<K, int>;
+    CaseResult r;
+    r.keyType = keyType;
+    r.order = order;
+    r.size = n;
+    
+    r.op = "associate";
+    r.phase = timePhase(misses, n, [&]() {
+        for (int i = 0; i != n; i++)
+            map->associate(inserted[i], i);
+    });
+    r.height = map->height();
+    results.push_back(r);
+    
+    r.op = "find_hit";
+    r.phase = timePhase(misses, n, [&]() {
+        long long sum = 0;
+        for (int i = 0; i != n; i++)
+            sum += *map->find(hits[i]);
+        g_sink = sum;
+    });
+    results.push_back(r);
+    
+    r.op = "find_miss";
+    r.phase = timePhase(misses, n, [&]() {
+        long long found = 0;
+        for (int i = 0; i != n; i++)
+            found += map->find(absent[i]) != nullptr;
+        g_sink = found;
+    });
+    results.push_back(r);
+    
+    r.op = "clear";
+    r.phase = timePhase(misses, n, [&]() {
+        map->clear();
+    });
+    results.push_back(r);
+    delete map;
+    
+    for (size_t i = results.size() - 4; i != results.size(); i++)
+    {
+        cerr << keyType << " " << order << " " << n << " " << results[i].op << ": " << results[i].phase.nsPerOp
+             << " ns/op, height " << results[i].height << endl;
+    }
+}
+
+void usage()
+{
+    cerr << "usage: mymapbench [--max-size N] [--max-degenerate N] [--seed S] [--out results.json]" << endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int maxSize = 10000000;
+    int maxDegenerate = 30000;
+    unsigned seed = 1;
+    string outFile;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage();
+            return 2;
+        }
+        string value = argv[++i];
+        if (arg == "--max-size")
+            maxSize = atoi(value.c_str());
+        else if (arg == "--max-degenerate")
+            maxDegenerate = atoi(value.c_str());
+        else if (arg == "--seed")
+            seed = unsigned(atoi(value.c_str()));
+        else if (arg == "--out")
+            outFile = value;
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    
+    CacheMissCounter misses;
+    if (! misses.available())
+        cerr << "mymapbench: no perf events here, so no cache miss counts" << endl;
+    
+    vector<CaseResult> results;
+    vector<int> skipped;
+    const char* orders[] = { "sorted", "reverse", "random", "clustered" };
+    for (int n = 1000; n <= maxSize; n *= 10)
+    {
+        for (size_t o = 0; o != sizeof(orders) / sizeof(orders[0]); o++)
+        {
+            string order = orders[o];
+            if ((order == "sorted" || order == "reverse") && n > maxDegenerate)
+                continue;
+            mt19937 rng(seed); //same orders and probes for every key type
+            benchKey<int>("int", order, n, rng, misses, results);
+            rng.seed(seed);
+            benchKey<string>("string", order, n, rng, misses, results);
+            rng.seed(seed);
+            benchKey<GeoCoord>("GeoCoord", order, n, rng, misses, results);
+        }
+    }
+    
+    ostringstream json;
+    json << "{\n  \"seed\": " << seed << ",\n  \"max_degenerate\": " << maxDegenerate
+         << ",\n  \"cache_misses_available\": " << (misses.available() ? "true" : "false") << ",\n  \"results\": [";
+    for (size_t i = 0; i != results.size(); i++)
+    {
+        const CaseResult& r = results[i];
+        json << (i == 0 ? "" : ",") << "\n    {\"key\": \"" << r.keyType << "\", \"order\": \"" << r.order
+             << "\", \"size\": " << r.size << ", \"op\": \"" << r.op << "\", \"ns_per_op\": " << r.phase.nsPerOp
+             << ", \"cache_misses_per_op\": ";
+        if (r.phase.missesPerOp < 0)
+            json << "null";
+        else
+            json << r.phase.missesPerOp;
+        json << ", \"height\": " << r.height << "}";
+    }
+    json << "\n  ]\n}\n";
+    
+    if (outFile.empty())
+        cout << json.str();
+    else
+    {
+        ofstream out(outFile);
+        out << json.str();
+        if (! out)
+        {
+            cerr << "mymapbench: can't write " << outFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
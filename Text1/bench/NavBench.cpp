@@ -0,0 +1,455 @@
+//
+//  NavBench.cpp
+//  End-to-end benchmark: loads each map given on the command line, then times navigate
+//  over a few query mixes at 1, 2, 4, ... threads and writes the results as JSON.
+//
+//  Build from Text1/bench, with everything in Text1 but main.cpp:
+//    g++ -std=c++11 -O2 -pthread -I.. -o navbench NavBench.cpp ../AttractionMapper.cpp
+//        ../MapLoader.cpp ../Navigator.cpp ../NavigatorPool.cpp ../SegmentMapper.cpp ../support.cpp
+//
+//  Usage:
+//    navbench [--threads N] [--queries Q] [--seed S] [--out results.json] map.txt [more maps...]
+//
+//  Each map is benchmarked in a child process of its own, so its peak_rss_bytes isn't
+//  hidden by a bigger map that came before it.
+//
+//  Long queries on big maps take seconds each (about 10s at the median on a one-million
+//  segment mapgen grid), so keep --queries small there; 50 runs every mix in a few minutes
+//  per thread count.
+//
+
+#include "provided.h"
+#include "support.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Peak for the whole process so far; it never goes down, hence one process per map
+size_t peakRssBytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) * 1024; //kilobytes on Linux
+}
+
+size_t fileBytes(const string& file)
+{
+    ifstream in(file, ios::binary | ios::ate);
+    return in ? size_t(in.tellg()) : 0;
+}
+
+struct Place
+{
+    string name;
+    GeoCoord gc;
+    size_t component; //routes only exist between places with the same one
+};
+
+struct Query
+{
+    size_t from, to;
+};
+
+struct Latency
+{
+    double p50, p95, p99, max, mean;
+};
+
+Latency summarize(vector<double>& micros)
+{
+    Latency l = { 0, 0, 0, 0, 0 };
+    if (micros.empty())
+        return l;
+    sort(micros.begin(), micros.end());
+    size_t n = micros.size();
+    l.p50 = micros[n * 50 / 100];
+    l.p95 = micros[min(n - 1, n * 95 / 100)];
+    l.p99 = micros[min(n - 1, n * 99 / 100)];
+    l.max = micros.back();
+    double sum = 0;
+    for (size_t i = 0; i != n; i++)
+        sum += micros[i];
+    l.mean = sum / n;
+    return l;
+}
+
+struct MixResult
+{
+    string mix;
+    size_t threads;
+    size_t queries;
+    double seconds;
+    Latency latency;
+    size_t failures; //answers other than the one the mix expects
+};
+
+// Runs every query in the mix once, spread over the given number of threads sharing nav
+MixResult runMix(const Navigator& nav, const vector<Place>& places, const string& mix, const vector<Query>& queries,
+                 NavResult expected, size_t threads)
+{
+    vector<vector<double> > micros(threads);
+    vector<size_t> failures(threads, 0);
+    Clock::time_point start = Clock::now();
+    vector<thread> workers;
+    for (size_t t = 0; t != threads; t++)
+    {
+        workers.push_back(thread([&, t]() {
+            vector<NavSegment> directions;
+            for (size_t i = t; i < queries.size(); i += threads)
+            {
+                Clock::time_point q = Clock::now();
+                NavResult r = nav.navigate(places[queries[i].from].name, places[queries[i].to].name, directions);
+                micros[t].push_back(secondsSince(q) * 1e6);
+                if (r != expected)
+                    failures[t]++;
+            }
+        }));
+    }
+    for (size_t t = 0; t != threads; t++)
+        workers[t].join();
+    
+    MixResult result;
+    result.mix = mix;
+    result.threads = threads;
+    result.queries = queries.size();
+    result.seconds = secondsSince(start);
+    vector<double> all;
+    result.failures = 0;
+    for (size_t t = 0; t != threads; t++)
+    {
+        all.insert(all.end(), micros[t].begin(), micros[t].end());
+        result.failures += failures[t];
+    }
+    result.latency = summarize(all);
+    return result;
+}
+
+void writeLatency(ostream& out, const Latency& l)
+{
+    out << "{\"p50\": " << l.p50 << ", \"p95\": " << l.p95 << ", \"p99\": " << l.p99
+        << ", \"max\": " << l.max << ", \"mean\": " << l.mean << "}";
+}
+
+string jsonString(const string& s)
+{
+    string out = "\"";
+    for (size_t i = 0; i != s.size(); i++)
+    {
+        if (s[i] == '"' || s[i] == '\\')
+            out += '\\';
+        if ((unsigned char)s[i] >= 0x20)
+            out += s[i];
+    }
+    return out + "\"";
+}
+
+size_t findRoot(vector<size_t>& parent, size_t s)
+{
+    while (parent[s] != s)
+    {
+        parent[s] = parent[parent[s]];
+        s = parent[s];
+    }
+    return s;
+}
+
+// Labels each segment with its connected piece of the network, joining segments that share an
+// end or an attraction, the way Navigator does at load
+vector<size_t> labelComponents(const MapLoader& ml, const SegmentMapper& sm)
+{
+    size_t n = ml.getNumSegments();
+    vector<size_t> parent(n);
+    for (size_t s = 0; s != n; s++)
+        parent[s] = s;
+    for (size_t s = 0; s != n; s++)
+    {
+        const StreetSegment& seg = ml.getSegmentRef(s);
+        vector<GeoCoord> points;
+        points.push_back(seg.segment.start);
+        points.push_back(seg.segment.end);
+        for (size_t a = 0; a != seg.attractions.size(); a++)
+            points.push_back(seg.attractions[a].geocoordinates);
+        for (size_t p = 0; p != points.size(); p++)
+        {
+            const vector<size_t>& there = sm.getSegmentIds(points[p]);
+            for (size_t j = 0; j != there.size(); j++)
+                parent[findRoot(parent, there[j])] = findRoot(parent, s);
+        }
+    }
+    for (size_t s = 0; s != n; s++)
+        parent[s] = findRoot(parent, s);
+    return parent;
+}
+
+// Loads one map, times it piece by piece, runs the mixes, and appends its JSON object to out
+bool benchMap(const string& file, size_t maxThreads, size_t numQueries, unsigned seed, ostream& out)
+{
+    size_t bytes = fileBytes(file);
+    
+    // Parse and index build timed separately, on their own objects, which are gone before
+    // the Navigator loads so the peak RSS only counts one copy of the map
+    double loadSeconds, indexSeconds;
+    size_t numSegments;
+    vector<Place> places;
+    {
+        MapLoader ml;
+        Clock::time_point start = Clock::now();
+        if (! ml.load(file))
+            return false;
+        loadSeconds = secondsSince(start);
+        AttractionMapper am;
+        SegmentMapper sm;
+        start = Clock::now();
+        am.init(ml);
+        sm.init(ml);
+        indexSeconds = secondsSince(start);
+        
+        numSegments = ml.getNumSegments();
+        vector<size_t> component = labelComponents(ml, sm);
+        for (size_t s = 0; s != numSegments; s++)
+        {
+            const StreetSegment& seg = ml.getSegmentRef(s);
+            for (size_t a = 0; a != seg.attractions.size(); a++)
+            {
+                Place p;
+                p.name = seg.attractions[a].name;
+                p.gc = seg.attractions[a].geocoordinates;
+                p.component = component[s];
+                places.push_back(p);
+            }
+        }
+    }
+    
+    Navigator nav;
+    Clock::time_point start = Clock::now();
+    nav.loadMapData(file);
+    double navLoadSeconds = secondsSince(start);
+    cerr << file << ": loaded " << numSegments << " segments in " << loadSeconds + indexSeconds + navLoadSeconds << "s" << endl;
+    
+    // Random pairs make the random mix. A bigger pool of pairs, sorted by straight-line
+    // distance, gives the short and long mixes from its two ends; pairs in different
+    // components make the unreachable mix. Sorting pairs by component rather than by
+    // searching keeps a big map from spending ages here before anything is timed.
+    mt19937 rng(seed);
+    vector<Query> random, shortest, longest, unreachable;
+    if (places.size() >= 2)
+    {
+        uniform_int_distribution<size_t> pick(0, places.size() - 1);
+        vector<pair<double, Query> > pool;
+        for (size_t i = 0; i != 4 * numQueries; i++)
+        {
+            Query q = { pick(rng), pick(rng) };
+            if (q.from == q.to)
+                continue;
+            if (random.size() != numQueries)
+                random.push_back(q);
+            if (places[q.from].component != places[q.to].component)
+            {
+                if (unreachable.size() != numQueries)
+                    unreachable.push_back(q);
+            }
+            else
+                pool.push_back(make_pair(distanceEarthMiles(places[q.from].gc, places[q.to].gc), q));
+        }
+        sort(pool.begin(), pool.end(), [](const pair<double, Query>& a, const pair<double, Query>& b) {
+            return a.first < b.first;
+        });
+        size_t quarter = min(numQueries, pool.size() / 4);
+        for (size_t i = 0; i != quarter; i++)
+        {
+            shortest.push_back(pool[i].second);
+            longest.push_back(pool[pool.size() - 1 - i].second);
+        }
+    }
+    
+    out << "    {\n      \"map\": " << jsonString(file) << ",\n"
+        << "      \"bytes\": " << bytes << ",\n"
+        << "      \"segments\": " << numSegments << ",\n"
+        << "      \"attractions\": " << places.size() << ",\n"
+        << "      \"components\": " << nav.getNumComponents() << ",\n"
+        << "      \"load_seconds\": " << loadSeconds << ",\n"
+        << "      \"load_mb_per_second\": " << (loadSeconds > 0 ? bytes / 1e6 / loadSeconds : 0) << ",\n"
+        << "      \"index_build_seconds\": " << indexSeconds << ",\n"
+        << "      \"navigator_load_seconds\": " << navLoadSeconds << ",\n"
+        << "      \"navigator_bytes\": " << nav.memoryUsage().total() << ",\n"
+        << "      \"runs\": [";
+    
+    struct Mix
+    {
+        const char* name;
+        const vector<Query>* queries;
+        NavResult expected;
+    } mixes[] = {
+        { "random", &random, NAV_SUCCESS },
+        { "short", &shortest, NAV_SUCCESS },
+        { "long", &longest, NAV_SUCCESS },
+        { "unreachable", &unreachable, NAV_NO_ROUTE },
+    };
+    vector<size_t> threadCounts; //1, 2, 4, ... and maxThreads itself
+    for (size_t threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+    bool first = true;
+    for (size_t m = 0; m != sizeof(mixes) / sizeof(mixes[0]); m++)
+    {
+        if (mixes[m].queries->empty())
+            continue;
+        for (size_t c = 0; c != threadCounts.size(); c++)
+        {
+            MixResult r = runMix(nav, places, mixes[m].name, *mixes[m].queries, mixes[m].expected, threadCounts[c]);
+            if (mixes[m].expected == NAV_SUCCESS && mixes[m].queries == &random)
+                r.failures = 0; //random pairs may or may not have a route
+            cerr << file << " " << r.mix << " x" << r.threads << ": p50 " << r.latency.p50 << "us, p99 "
+                 << r.latency.p99 << "us, " << r.queries / r.seconds << " q/s" << endl;
+            out << (first ? "" : ",") << "\n        {\"mix\": \"" << r.mix << "\", \"threads\": " << r.threads
+                << ", \"queries\": " << r.queries << ", \"seconds\": " << r.seconds
+                << ", \"queries_per_second\": " << (r.seconds > 0 ? r.queries / r.seconds : 0)
+                << ", \"failures\": " << r.failures << ", \"latency_us\": ";
+            writeLatency(out, r.latency);
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n      ],\n      \"peak_rss_bytes\": " << peakRssBytes() << "\n    }";
+    return true;
+}
+
+// Runs benchMap in a child process and hands back the JSON it wrote. The parent never
+// loads a map, so each child starts from the same small footprint.
+bool benchMapInChild(const string& file, size_t maxThreads, size_t numQueries, unsigned seed, string& result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        ostringstream out;
+        bool ok = benchMap(file, maxThreads, numQueries, seed, out);
+        string s = out.str();
+        for (size_t done = 0; ok && done != s.size(); )
+        {
+            ssize_t n = write(fds[1], s.data() + done, s.size() - done);
+            if (n <= 0)
+                ok = false;
+            else
+                done += size_t(n);
+        }
+        close(fds[1]);
+        _exit(ok ? 0 : 1);
+    }
+    
+    close(fds[1]);
+    result.clear();
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+        result.append(buf, size_t(n));
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void usage()
+{
+    cerr << "usage: navbench [--threads N] [--queries Q] [--seed S] [--out results.json] map.txt [more maps...]" << endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t maxThreads = thread::hardware_concurrency();
+    if (maxThreads == 0)
+        maxThreads = 1;
+    size_t numQueries = 1000;
+    unsigned seed = 1;
+    string outFile;
+    vector<string> maps;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue)
+            maxThreads = max(1, atoi(argv[++i]));
+        else if (arg == "--queries" && hasValue)
+            numQueries = max(1, atoi(argv[++i]));
+        else if (arg == "--seed" && hasValue)
+            seed = unsigned(atoi(argv[++i]));
+        else if (arg == "--out" && hasValue)
+            outFile = argv[++i];
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            usage();
+            return 2;
+        }
+        else
+            maps.push_back(arg);
+    }
+    if (maps.empty())
+    {
+        usage();
+        return 2;
+    }
+    
+    ostringstream json;
+    json << "{\n  \"threads\": " << maxThreads << ",\n  \"queries_per_mix\": " << numQueries
+         << ",\n  \"seed\": " << seed << ",\n  \"maps\": [\n";
+    for (size_t i = 0; i != maps.size(); i++)
+    {
+        if (i != 0)
+            json << ",\n";
+        string result;
+        if (! benchMapInChild(maps[i], maxThreads, numQueries, seed, result))
+        {
+            cerr << "navbench: can't load " << maps[i] << endl;
+            return 1;
+        }
+        json << result;
+    }
+    json << "\n  ]\n}\n";
+    
+    if (outFile.empty())
+        cout << json.str();
+    else
+    {
+        ofstream out(outFile);
+        out << json.str();
+        if (! out)
+        {
+            cerr << "navbench: can't write " << outFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -14,6 +14,9 @@
 #include <algorithm>
 #include <cmath>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <atomic>
 using namespace std;
 
 int main()
@@ -122,6 +125,650 @@ int main()
         }
     }
     cout << "Navigator PASSED" << endl;
+    
+    cout << "About to test route cache" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        nav.setRouteCacheCapacity(1);
+        vector<NavSegment> first, second;
+        assert(nav.navigate("Eros Statue", "Hamleys Toy Store", first) == NAV_SUCCESS);
+        assert(nav.navigate("EROS STATUE", "hamleys toy store", second) == NAV_SUCCESS);
+        assert(second.size() == first.size());
+        for (size_t i = 0; i != first.size(); i++) //rebuilt from the cached path just as it was
+        {
+            assert(second[i].m_command == first[i].m_command && second[i].m_streetName == first[i].m_streetName);
+            assert(second[i].m_distance == first[i].m_distance && second[i].m_direction == first[i].m_direction);
+        }
+        RouteCacheStats stats = nav.getRouteCacheStats();
+        assert(stats.hits == 1 && stats.misses == 1 && stats.size == 1);
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", second) == NAV_SUCCESS);
+        assert(nav.getRouteCacheStats().evictions == 1);
+        assert(nav.loadMapData("testmap.txt"));
+        assert(nav.getRouteCacheStats().size == 0);
+    }
+    cout << "route cache PASSED" << endl;
+    
+    cout << "About to test NavigatorPool" << endl;
+    {
+        NavigatorPool pool(4);
+        assert(pool.loadMapData("testmap.txt"));
+        vector<NavQuery> queries;
+        for (int i = 0; i < 100; i++)
+        {
+            NavQuery q;
+            q.start = (i % 2 == 0) ? "Eros Statue" : "Hamleys Toy Store";
+            q.end = (i % 2 == 0) ? "Hamleys Toy Store" : "Eros Statue";
+            queries.push_back(q);
+        }
+        queries.push_back(NavQuery{"Nowhere", "Eros Statue"});
+        vector<NavAnswer> answers = pool.navigateAll(queries);
+        assert(answers.size() == queries.size());
+        for (size_t i = 0; i + 1 < answers.size(); i++)
+            assert(answers[i].result == NAV_SUCCESS && answers[i].directions.size() == 6);
+        assert(answers.back().result == NAV_BAD_SOURCE);
+    }
+    cout << "NavigatorPool PASSED" << endl;
+    
+    cout << "About to test deadlines and cancellation" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        NavDeadline later = chrono::steady_clock::now() + chrono::seconds(10);
+        NavAnswer a = nav.navigateAsync("Eros Statue", "Hamleys Toy Store", later).get();
+        assert(a.result == NAV_SUCCESS && a.directions.size() == 6);
+        
+        NavigatorPool pool(2);
+        assert(pool.loadMapData("testmap.txt"));
+        NavDeadline gone = chrono::steady_clock::now() - chrono::seconds(1);
+        assert(pool.submit("Eros Statue", "Hamleys Toy Store", gone).get().result == NAV_TIMEOUT);
+        CancelToken token;
+        token.cancel();
+        assert(pool.submit("Eros Statue", "Hamleys Toy Store", later, token).get().result == NAV_CANCELLED);
+    }
+    cout << "deadlines and cancellation PASSED" << endl;
+    
+    cout << "About to test reachable" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        Reachability near, far;
+        assert(nav.reachable("Eros Statue", 0.05, near) == NAV_SUCCESS);
+        assert(nav.reachable("Eros Statue", 10, far) == NAV_SUCCESS);
+        assert(near.attractions.size() == 1 && near.attractions[0].name == "Eros Statue");
+        assert(far.attractions.size() == 2 && far.attractions[1].name == "Hamleys Toy Store");
+        assert(abs(far.attractions[1].distance - (0.0138 + 0.0119 + 0.0845 + 0.0696 + 0.1871)) < 0.002);
+        assert(near.nodes.size() < far.nodes.size());
+        for (size_t i = 1; i < far.nodes.size(); i++)
+            assert(far.nodes[i-1].distance <= far.nodes[i].distance);
+        assert(nav.reachable("Nowhere", 1, far) == NAV_BAD_SOURCE);
+    }
+    cout << "reachable PASSED" << endl;
+    
+    cout << "About to test alternatives" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavRoute> routes;
+        assert(nav.alternatives("Eros Statue", "Hamleys Toy Store", 3, routes) == NAV_SUCCESS);
+        assert(routes.size() == 1); //the test map is a tree, so there's only one way
+        assert(routes[0].directions.size() == 6);
+        assert(nav.alternatives("Eros Statue", "Nowhere", 3, routes) == NAV_BAD_DESTINATION);
+        
+        // loopmap.txt: straight along Main Street, or round the south or the north block
+        Navigator loops;
+        assert(loops.loadMapData("loopmap.txt"));
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 3, 0.5) == NAV_SUCCESS);
+        assert(routes.size() == 3);
+        vector<GeoSegment> used; //every road of the routes so far
+        for (size_t i = 0; i != routes.size(); i++)
+        {
+            assert(routes[i].distance <= 3 * routes[0].distance);
+            assert(i == 0 || routes[i].distance > routes[i-1].distance);
+            double miles = 0, shared = 0;
+            const vector<NavSegment>& d = routes[i].directions;
+            for (size_t j = 0; j != d.size(); j++)
+            {
+                if (d[j].m_command != NavSegment::PROCEED)
+                    continue;
+                miles += d[j].m_distance;
+                for (size_t u = 0; u != used.size(); u++)
+                {
+                    if ((used[u].start == d[j].m_geoSegment.start && used[u].end == d[j].m_geoSegment.end)
+                        || (used[u].start == d[j].m_geoSegment.end && used[u].end == d[j].m_geoSegment.start))
+                    {
+                        shared += d[j].m_distance;
+                        break;
+                    }
+                }
+            }
+            assert(abs(miles - routes[i].distance) < 1e-9);
+            assert(shared <= 0.5 * miles);
+            assert(i == 0 || shared > 0); //Main Street at both ends
+            for (size_t j = 0; j != d.size(); j++)
+                if (d[j].m_command == NavSegment::PROCEED)
+                    used.push_back(d[j].m_geoSegment);
+        }
+        double south = routes[1].distance, north = routes[2].distance;
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 2, 0.5) == NAV_SUCCESS);
+        assert(routes.size() == 2 && routes[1].distance == south); //the north way is too long
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 3, 0.35) == NAV_SUCCESS);
+        assert(routes.size() == 2 && routes[1].distance == north); //the south way shares too much
+        assert(loops.alternatives("Start Cafe", "End Museum", 1, routes, 3, 0.5) == NAV_SUCCESS);
+        assert(routes.size() == 1);
+        
+        NavDeadline gone = chrono::steady_clock::now() - chrono::seconds(1);
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 3, 0.5, gone) == NAV_TIMEOUT);
+        assert(routes.empty());
+        CancelToken token;
+        token.cancel();
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 3, 0.5, NavDeadline::max(), token)
+               == NAV_CANCELLED);
+        assert(routes.empty());
+        assert(loops.alternatives("Start Cafe", "End Museum", 3, routes, 3, 0.5, NavDeadline::max(), CancelToken())
+               == NAV_SUCCESS);
+        assert(routes.size() == 3);
+    }
+    cout << "alternatives PASSED" << endl;
+    
+    cout << "About to test batch distance and angle" << endl;
+    {
+        const double lat1[5] = { 51.509862, 51.513719, 34.0572, -33.86, 0 };
+        const double lon1[5] = { -0.134848, -0.141174, -118.441762, 151.21, 0 };
+        const double lat2[5] = { 51.510087, 51.510377, 34.0572, 40.71, 0 };
+        const double lon2[5] = { -0.134563, -0.138209, -118.44, -74.0, 0 };
+        double km[5], deg[5];
+        distanceEarthKMBatch(lat1, lon1, lat2, lon2, km, 5);
+        angleOfLineBatch(lat1, lon1, lat2, lon2, deg, 5);
+        for (size_t i = 0; i < 5; i++)
+        {
+            GeoCoord a, b;
+            a.latitude = lat1[i]; a.longitude = lon1[i];
+            b.latitude = lat2[i]; b.longitude = lon2[i];
+            assert(abs(km[i] - distanceEarthKM(a, b)) < 2e-9);
+            assert(abs(deg[i] - angleOfLine(GeoSegment(a, b))) < 1e-12);
+        }
+    }
+    cout << "batch distance and angle PASSED" << endl;
+    
+    cout << "About to test turn costs" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        TurnCosts costs;
+        costs.left = 0.5;
+        costs.right = 0.1;
+        costs.uTurn = 2;
+        nav.setTurnCosts(costs);
+        vector<NavSegment> directions;
+        assert(nav.navigate("Eros Statue", "Hamleys Toy Store", directions) == NAV_SUCCESS);
+        assert(directions.size() == 6); //still the only way there
+        assert(directions[1].m_command == NavSegment::TURN && directions[1].m_direction == "left");
+        
+        // costs changing while queries run and fill the cache
+        nav.setRouteCacheCapacity(10);
+        atomic<bool> done(false);
+        thread tweaker([&nav, &done]() {
+            TurnCosts c;
+            c.uTurn = 2; //else going right and turning back beats a left
+            for (int i = 0; ! done; i++)
+            {
+                c.left = i % 2 == 0 ? 0.5 : 0;
+                nav.setTurnCosts(c);
+            }
+        });
+        for (int i = 0; i != 200; i++)
+            assert(nav.navigate("Eros Statue", "Hamleys Toy Store", directions) == NAV_SUCCESS && directions.size() == 6);
+        done = true;
+        tweaker.join();
+        
+        // loopmap.txt has blocks to drive round: with lefts dear enough, three rights beat one left
+        Navigator loops;
+        assert(loops.loadMapData("loopmap.txt"));
+        NavStats stats;
+        assert(loops.navigate("Start Cafe", "West Tower", directions, stats) == NAV_SUCCESS);
+        double miles = 0;
+        for (size_t i = 0; i != directions.size(); i++)
+            if (directions[i].m_command == NavSegment::PROCEED)
+                miles += directions[i].m_distance;
+        assert(directions.size() == 3 && directions[1].m_direction == "left");
+        bool inMiles = string(Navigator::costUnit()) == "miles"; //else hours, at speeds only the navigator knows
+        assert(inMiles ? abs(stats.routeCost - miles) < 1e-9 : stats.routeCost > 0);
+        
+        costs.left = 1;
+        costs.right = 0.1;
+        costs.uTurn = 1;
+        loops.setTurnCosts(costs);
+        assert(loops.navigate("Start Cafe", "West Tower", directions, stats) == NAV_SUCCESS);
+        double around = 0;
+        size_t rights = 0;
+        for (size_t i = 0; i != directions.size(); i++)
+        {
+            if (directions[i].m_command == NavSegment::PROCEED)
+                around += directions[i].m_distance;
+            else
+            {
+                assert(directions[i].m_direction == "right");
+                rights++;
+            }
+        }
+        assert(rights == 3 && around > miles);
+        if (inMiles)
+        {
+            assert(abs(stats.routeCost - (around + 3 * costs.right)) < 1e-9); //the penalties count, but aren't driven
+            assert(stats.routeCost < miles + costs.left);
+        }
+        loops.setRouteCacheCapacity(4);
+        double cost = stats.routeCost;
+        loops.navigate("Start Cafe", "West Tower", directions, stats);
+        assert(loops.navigate("Start Cafe", "West Tower", directions, stats) == NAV_SUCCESS);
+        assert(stats.cacheHit && stats.routeCost == cost);
+    }
+    cout << "turn costs PASSED" << endl;
+    
+    cout << "About to test navigateSteps" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavSegment> directions;
+        assert(nav.navigate("Eros Statue", "Hamleys Toy Store", directions) == NAV_SUCCESS);
+        vector<NavStep> steps;
+        assert(nav.navigateSteps("Eros Statue", "Hamleys Toy Store",
+                                 [&steps](const NavStep& s) { steps.push_back(s); }) == NAV_SUCCESS);
+        assert(steps.size() == directions.size());
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+            assert(steps[i].command == directions[i].m_command);
+            assert(navDirectionText(steps[i].direction) == directions[i].m_direction);
+            assert(nav.getStreetName(steps[i].streetId) == directions[i].m_streetName);
+            if (steps[i].command == NavSegment::PROCEED)
+                assert(steps[i].distance == directions[i].m_distance);
+        }
+        assert(steps[2].streetId == steps[5].streetId); //all Regent Street
+    }
+    cout << "navigateSteps PASSED" << endl;
+    
+    cout << "About to test polylines" << endl;
+    {
+        //the example from the Google polyline format documentation
+        const double lat[3] = { 38.5, 40.7, 43.252 };
+        const double lon[3] = { -120.2, -120.95, -126.453 };
+        assert(encodePolyline(lat, lon, 3) == "_p~iF~ps|U_ulLnnqC_mqNvxq`@");
+        vector<double> la, lo;
+        assert(decodePolyline("_p~iF~ps|U_ulLnnqC_mqNvxq`@", la, lo));
+        assert(la.size() == 3 && abs(la[2] - 43.252) < 1e-9 && abs(lo[1] + 120.95) < 1e-9);
+        assert(! decodePolyline("_p~iF~ps|U_", la, lo));
+        
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        string polyline;
+        assert(nav.navigatePolyline("Eros Statue", "Hamleys Toy Store", polyline, 6) == NAV_SUCCESS);
+        assert(decodePolyline(polyline, la, lo, 6));
+        assert(la.size() == 6); //start, four corners, end
+        assert(abs(la[0] - 51.509894) < 1e-9 && abs(lo[5] + 0.140114) < 1e-9);
+    }
+    cout << "polylines PASSED" << endl;
+    
+    cout << "About to test components" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        assert(nav.getNumComponents() == 1);
+        vector<ComponentInfo> stats = nav.getComponentStats();
+        assert(stats[0].segments == 7 && stats[0].attractions == 2);
+    }
+    cout << "components PASSED" << endl;
+    
+    cout << "About to test nav stats" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavSegment> directions;
+        NavStats stats;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions, stats) == NAV_SUCCESS);
+        assert(stats.nodesExpanded > 0 && stats.heapPops >= stats.nodesExpanded);
+        assert(stats.heapPushes >= stats.heapPops && stats.peakHeap > 0 && stats.mapProbes > 0);
+        assert(stats.edgesRelaxed >= stats.nodesExpanded && ! stats.cacheHit);
+        assert(stats.totalMicros >= stats.searchMicros);
+        assert(lastNavStats().nodesExpanded == stats.nodesExpanded);
+        assert(stats.nameLookups == 2 && stats.bytesAllocated >= stats.nodesExpanded * sizeof(double));
+        assert(nav.navigate("Hamleys Toy Store", "nowhere", directions, stats) == NAV_BAD_DESTINATION);
+        assert(stats.nameLookups == 2 && stats.mapProbes == 0 && stats.bytesAllocated == 0);
+        nav.setRouteCacheCapacity(4);
+        nav.navigate("Hamleys Toy Store", "Eros Statue", directions, stats);
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions, stats) == NAV_SUCCESS);
+        assert(stats.cacheHit && stats.mapProbes == 3 && stats.bytesAllocated == 0); //both ends' segments, then the cache
+        nav.setRouteCacheCapacity(0);
+        
+        resetNavStats();
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        assert(navStatsSummary().queries == 0); //off unless enabled
+        enableNavStats(true);
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        assert(nav.navigate("Hamleys Toy Store", "nowhere", directions) == NAV_BAD_DESTINATION);
+        enableNavStats(false);
+        NavStatsSummary summary = navStatsSummary();
+        assert(summary.queries == 2);
+        size_t counted = 0;
+        for (int i = 0; i != NavStatsSummary::BUCKETS; i++)
+            counted += summary.nodesExpanded[i];
+        assert(counted == 2 && summary.nodesExpanded[0] == 1);
+    }
+    cout << "nav stats PASSED" << endl;
+    
+    cout << "About to test tracing" << endl;
+    {
+        enableTracing(true);
+        clearTrace();
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavSegment> directions;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        thread other([&nav]() {
+            vector<NavSegment> d;
+            assert(nav.navigate("Eros Statue", "Hamleys Toy Store", d) == NAV_SUCCESS);
+        });
+        other.join();
+        enableTracing(false);
+        string json = traceJson();
+        assert(json.find("\"traceEvents\"") != string::npos);
+        assert(json.find("\"MapLoader::load\"") != string::npos);
+        assert(json.find("\"SegmentMapper::init\"") != string::npos);
+        assert(json.find("\"search\"") != string::npos);
+        assert(json.find("\"tid\":") != json.rfind("\"tid\":")); //more than one span
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        assert(traceJson() == json); //nothing recorded while off
+        clearTrace();
+        assert(traceJson().find("search") == string::npos);
+    }
+    cout << "tracing PASSED" << endl;
+    
+    cout << "About to test memory usage" << endl;
+    {
+        Navigator nav;
+        assert(nav.memoryUsage().total() == 0);
+        assert(nav.loadMapData("testmap.txt"));
+        MemoryUsage loaded = nav.memoryUsage();
+        assert(loaded.segments >= 7 * sizeof(StreetSegment));
+        assert(loaded.segmentTables >= 7 * 3 * sizeof(double) && loaded.attractions >= 2 * sizeof(Attraction));
+        assert(loaded.attractionIndex > 0 && loaded.segmentIndex > 0 && loaded.streetNames > 0);
+        assert(loaded.turnTable > 0 && loaded.components > 0 && loaded.routeCache == 0);
+        nav.setRouteCacheCapacity(4);
+        vector<NavSegment> directions;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        assert(nav.memoryUsage().routeCache > 0);
+        assert(nav.loadMapData("testmap.txt"));
+        MemoryUsage reloaded = nav.memoryUsage();
+        assert(reloaded.routeCache == 0 && reloaded.total() == loaded.total()); //nothing left over from before
+    }
+    cout << "memory usage PASSED" << endl;
+    
+    cout << "About to test nearest attractions" << endl;
+    {
+        MapLoader ml;
+        assert(ml.load("testmap.txt"));
+        AttractionMapper am;
+        am.init(ml);
+        GeoCoord eros, hamleys;
+        assert(am.getGeoCoord("Eros Statue", eros) && am.getGeoCoord("Hamleys Toy Store", hamleys));
+        vector<Attraction> nearest = am.nearestAttractions(eros, 10);
+        assert(nearest.size() == 2 && nearest[0].name == "Eros Statue" && nearest[1].name == "Hamleys Toy Store");
+        nearest = am.nearestAttractions(hamleys, 1);
+        assert(nearest.size() == 1 && nearest[0].name == "Hamleys Toy Store");
+        assert(am.nearestAttractions(eros, 0).empty());
+        
+        double apart = distanceEarthKM(eros, hamleys);
+        vector<Attraction> within = am.attractionsWithinRadius(hamleys, apart * 0.99);
+        assert(within.size() == 1 && within[0].name == "Hamleys Toy Store");
+        within = am.attractionsWithinRadius(hamleys, apart * 1.01);
+        assert(within.size() == 2 && within[1].name == "Eros Statue");
+    }
+    cout << "nearest attractions PASSED" << endl;
+    
+    cout << "About to test autocomplete" << endl;
+    {
+        MapLoader ml;
+        assert(ml.load("testmap.txt"));
+        AttractionMapper am;
+        am.init(ml);
+        vector<Attraction> found = am.complete("hamle", 5);
+        assert(found.size() == 1 && found[0].name == "Hamleys Toy Store");
+        found = am.complete("EROS STATUE", 5);
+        assert(found.size() == 1 && found[0].name == "Eros Statue");
+        assert(am.complete("eros statuex", 5).empty() && am.complete("q", 5).empty() && am.complete("", 0).empty());
+        found = am.complete("", 5);
+        assert(found.size() == 2 && found[0].name == "Eros Statue" && found[1].name == "Hamleys Toy Store");
+        assert(am.setCompletionWeight("hamleys toy store", 2) && ! am.setCompletionWeight("hamleys", 2));
+        found = am.complete("", 1);
+        assert(found.size() == 1 && found[0].name == "Hamleys Toy Store");
+    }
+    cout << "autocomplete PASSED" << endl;
+    
+    cout << "About to test fuzzy lookup" << endl;
+    {
+        MapLoader ml;
+        assert(ml.load("testmap.txt"));
+        AttractionMapper am;
+        am.init(ml);
+        vector<Attraction> found = am.fuzzyMatches("Hamley's Toy Store", 5);
+        assert(found.size() == 1 && found[0].name == "Hamleys Toy Store");
+        found = am.fuzzyMatches("EROS STATUE", 5, 0);
+        assert(found.size() == 1 && found[0].name == "Eros Statue");
+        assert(am.fuzzyMatches("eros stat", 5).size() == 1 && am.fuzzyMatches("eros stat", 5, 1).empty());
+        assert(am.fuzzyMatches("x", 5).empty() && am.fuzzyMatches("eros statue", 0).empty());
+        
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavSegment> directions;
+        assert(nav.navigate("Hamlys Toy Stor", "Eros Statue", directions) == NAV_BAD_SOURCE);
+        found = nav.suggestAttractions("Hamlys Toy Stor");
+        assert(found.size() == 1 && found[0].name == "Hamleys Toy Store");
+    }
+    cout << "fuzzy lookup PASSED" << endl;
+    
+    cout << "About to test batch geocoding" << endl;
+    {
+        MapLoader ml;
+        assert(ml.load("testmap.txt"));
+        AttractionMapper am;
+        am.init(ml);
+        vector<string> names;
+        for (int i = 0; i != 100; i++)
+            names.push_back(i % 3 == 0 ? "HAMLEYS toy store" : i % 3 == 1 ? "eros statue" : "nowhere");
+        vector<GeoCoord> coords(names.size());
+        unique_ptr<bool[]> found(new bool[names.size()]);
+        assert(am.getGeoCoords(names.data(), names.size(), coords.data(), found.get()) == 67);
+        for (size_t i = 0; i != names.size(); i++)
+        {
+            GeoCoord gc;
+            assert(found[i] == am.getGeoCoord(names[i], gc));
+            assert(! found[i] || (coords[i].latitude == gc.latitude && coords[i].longitude == gc.longitude));
+        }
+        assert(am.getGeoCoords(names.data(), 0, coords.data(), found.get()) == 0);
+    }
+    cout << "batch geocoding PASSED" << endl;
+    
+    cout << "About to test rerouting" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        vector<NavSegment> directions, again;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        double miles = 0;
+        for (size_t i = 0; i != directions.size(); i++)
+            if (directions[i].m_command == NavSegment::PROCEED)
+                miles += directions[i].m_distance;
+        vector<NavStep> steps;
+        nav.navigateSteps("Hamleys Toy Store", "Eros Statue", [&steps](const NavStep& s) { steps.push_back(s); });
+        
+        RerouteSession trip(nav);
+        assert(trip.update(again) == NAV_BAD_SOURCE); //nothing begun yet
+        assert(trip.begin("Hamleys Toy Store", "Eros Statue", again) == NAV_SUCCESS);
+        assert(again.size() == directions.size() && abs(trip.routeCost() - miles) < 1e-9);
+        
+        size_t seg = steps[1].segmentId;
+        assert(! trip.setSegmentCostFactor(seg, 0.5));
+        assert(trip.setSegmentCostFactor(seg, HUGE_VAL));
+        assert(trip.update(again) == NAV_NO_ROUTE); //the test map has no way round
+        assert(trip.setSegmentCostFactor(seg, 2));
+        assert(trip.update(again) == NAV_SUCCESS);
+        MapLoader ml;
+        assert(ml.load("testmap.txt"));
+        assert(abs(trip.routeCost() - miles - ml.getSegmentLength(seg)) < 1e-9);
+        assert(trip.setSegmentCostFactor(seg, 1));
+        
+        assert(! trip.moveTo(GeoCoord("0", "0")));
+        assert(trip.moveTo(GeoCoord("51.509919", "-0.136767"))); //partway down Regent Street
+        assert(trip.update(again) == NAV_SUCCESS);
+        assert(trip.routeCost() < miles && again[0].m_streetName == "Regent Street");
+        double left = 0;
+        for (size_t i = 0; i != again.size(); i++)
+            if (again[i].m_command == NavSegment::PROCEED)
+                left += again[i].m_distance;
+        assert(abs(trip.routeCost() - left) < 1e-9);
+        
+        // loopmap.txt has ways round a closure, and a destination to drive through
+        Navigator loops;
+        assert(loops.loadMapData("loopmap.txt"));
+        MapLoader lml;
+        assert(lml.load("loopmap.txt"));
+        RerouteSession drive(loops);
+        assert(drive.begin("Start Cafe", "End Museum", again) == NAV_SUCCESS);
+        double straight = lml.getSegmentLength(0) + lml.getSegmentLength(1) + lml.getSegmentLength(2);
+        assert(abs(drive.routeCost() - straight) < 1e-9);
+        assert(drive.setSegmentCostFactor(1, HUGE_VAL)); //Main Street between the blocks
+        assert(drive.update(again) == NAV_SUCCESS);
+        double south = lml.getSegmentLength(0) + lml.getSegmentLength(3) + lml.getSegmentLength(4)
+                     + lml.getSegmentLength(5) + lml.getSegmentLength(2);
+        assert(abs(drive.routeCost() - south) < 1e-9 && again[2].m_streetName == "West Lane");
+        assert(drive.setSegmentCostFactor(1, 1));
+        
+        assert(drive.moveTo(GeoCoord("34.001", "-118.400"))); //missed the turn, and went up West Lane
+        assert(drive.update(again) == NAV_SUCCESS);
+        assert(loops.navigate("West Tower", "End Museum", directions) == NAV_SUCCESS);
+        double back = 0;
+        for (size_t i = 0; i != directions.size(); i++)
+            if (directions[i].m_command == NavSegment::PROCEED)
+                back += directions[i].m_distance;
+        assert(abs(drive.routeCost() - back) < 1e-9);
+        assert(drive.moveTo(GeoCoord("34.000", "-118.396"))); //there
+        assert(drive.update(again) == NAV_SUCCESS && drive.routeCost() == 0);
+        assert(drive.moveTo(GeoCoord("34.000", "-118.400"))); //and out the other side
+        assert(drive.update(again) == NAV_SUCCESS);
+        assert(abs(drive.routeCost() - lml.getSegmentLength(1) - lml.getSegmentLength(2)) < 1e-9);
+    }
+    cout << "rerouting PASSED" << endl;
+    
+    cout << "About to test road closures" << endl;
+    {
+        Navigator nav;
+        assert(nav.loadMapData("testmap.txt"));
+        nav.setRouteCacheCapacity(10);
+        vector<NavSegment> directions;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        vector<NavStep> steps;
+        nav.navigateSteps("Hamleys Toy Store", "Eros Statue", [&steps](const NavStep& s) { steps.push_back(s); });
+        size_t seg = steps[1].segmentId;
+        assert(nav.getSegmentCostFactor(seg) == 1);
+        
+        vector<SegmentCostChange> changes(1);
+        changes[0].segId = seg;
+        changes[0].factor = HUGE_VAL;
+        assert(nav.updateClosures(changes));
+        assert(nav.getSegmentCostFactor(seg) == HUGE_VAL);
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_NO_ROUTE); //not the cached route
+        Reachability reach;
+        assert(nav.reachable("Hamleys Toy Store", 10, reach) == NAV_SUCCESS);
+        assert(reach.attractions.size() == 1); //only Hamleys itself
+        vector<NavRoute> routes;
+        assert(nav.alternatives("Hamleys Toy Store", "Eros Statue", 2, routes) == NAV_NO_ROUTE);
+        assert(nav.memoryUsage().closures > 0);
+        
+        changes[0].factor = 3; //open again, but slow
+        changes.push_back(changes[0]);
+        changes[1].segId = 100; //no such segment, so neither change happens
+        assert(! nav.updateClosures(changes));
+        assert(nav.getSegmentCostFactor(seg) == HUGE_VAL);
+        changes.pop_back();
+        assert(nav.updateClosures(changes) && nav.getSegmentCostFactor(seg) == 3);
+        vector<NavSegment> slowed;
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", slowed) == NAV_SUCCESS);
+        assert(slowed.size() == steps.size() && slowed[1].m_distance == steps[1].distance); //still real miles
+        changes[0].factor = 0.5;
+        assert(! nav.updateClosures(changes));
+        
+        // closing and opening over and over while queries run: each sees the segment one way or the other
+        atomic<bool> done(false);
+        thread roadworks([&nav, seg, &done]() {
+            vector<SegmentCostChange> flip(1);
+            flip[0].segId = seg;
+            for (int i = 0; ! done; i++)
+            {
+                flip[0].factor = i % 2 == 0 ? HUGE_VAL : 1;
+                nav.updateClosures(flip);
+            }
+        });
+        for (int i = 0; i != 200; i++)
+        {
+            NavResult r = nav.navigate("Hamleys Toy Store", "Eros Statue", directions);
+            assert(r == NAV_SUCCESS || r == NAV_NO_ROUTE);
+            assert(r == NAV_NO_ROUTE || directions.size() == steps.size());
+        }
+        done = true;
+        roadworks.join();
+        
+        nav.clearClosures();
+        assert(nav.getSegmentCostFactor(seg) == 1);
+        assert(nav.navigate("Hamleys Toy Store", "Eros Statue", directions) == NAV_SUCCESS);
+        assert(nav.loadMapData("testmap.txt") && nav.getSegmentCostFactor(seg) == 1);
+        
+        // loopmap.txt has ways round: with Main Street shut between the blocks the route goes
+        // round the south one, and with that slowed enough, round the north one
+        Navigator loops;
+        assert(loops.loadMapData("loopmap.txt"));
+        MapLoader lml;
+        assert(lml.load("loopmap.txt"));
+        vector<SegmentCostChange> shut(1);
+        shut[0].segId = 1;
+        shut[0].factor = HUGE_VAL;
+        assert(loops.updateClosures(shut));
+        NavStats stats;
+        assert(loops.navigate("Start Cafe", "End Museum", directions, stats) == NAV_SUCCESS);
+        bool inMiles = string(Navigator::costUnit()) == "miles";
+        double south = lml.getSegmentLength(0) + lml.getSegmentLength(3) + lml.getSegmentLength(4)
+                     + lml.getSegmentLength(5) + lml.getSegmentLength(2);
+        double miles = 0;
+        for (size_t i = 0; i != directions.size(); i++)
+            if (directions[i].m_command == NavSegment::PROCEED)
+                miles += directions[i].m_distance;
+        assert(abs(miles - south) < 1e-9 && directions[2].m_streetName == "West Lane");
+        assert(! inMiles || abs(stats.routeCost - south) < 1e-9);
+        
+        shut.push_back(shut[0]);
+        shut[1].segId = 4; //South Lane
+        shut[1].factor = 3;
+        assert(loops.updateClosures(shut));
+        assert(loops.navigate("Start Cafe", "End Museum", directions, stats) == NAV_SUCCESS);
+        double north = lml.getSegmentLength(0) + lml.getSegmentLength(6) + lml.getSegmentLength(7)
+                     + lml.getSegmentLength(8) + lml.getSegmentLength(2);
+        miles = 0;
+        bool viaNorth = false;
+        for (size_t i = 0; i != directions.size(); i++)
+        {
+            if (directions[i].m_command == NavSegment::PROCEED)
+                miles += directions[i].m_distance;
+            viaNorth = viaNorth || directions[i].m_streetName == "North Lane";
+        }
+        assert(viaNorth && abs(miles - north) < 1e-9);
+        assert(! inMiles || abs(stats.routeCost - north) < 1e-9);
+        assert(north < south + 2 * lml.getSegmentLength(4)); //what the slowed south way would have cost
+        loops.clearClosures();
+        assert(loops.navigate("Start Cafe", "End Museum", directions, stats) == NAV_SUCCESS);
+        assert(! inMiles || abs(stats.routeCost - lml.getSegmentLength(0) - lml.getSegmentLength(1) - lml.getSegmentLength(2)) < 1e-9);
+        for (size_t i = 0; i != directions.size(); i++)
+            assert(directions[i].m_streetName == "Main Street"); //straight through again
+    }
+    cout << "road closures PASSED" << endl;
 }
 
 
@@ -3,6 +3,11 @@
 
 #include <string>
 #include <vector>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
 
 struct GeoCoord
 {
@@ -46,6 +51,30 @@ struct StreetSegment
     std::vector<Attraction>	attractions;
 };
 
+// Heap bytes held by each part of a loaded Navigator. Containers the classes own count their
+// own allocations through tracking allocators; strings and vectors inside the public structs
+// (StreetSegment, GeoCoord, ...) use the plain allocator and are counted from the blocks they hold.
+struct MemoryUsage
+{
+    size_t segments = 0;        // MapLoader's StreetSegment array
+    size_t streetNames = 0;     // street name strings, the interned name list and its index
+    size_t attractions = 0;     // the segments' attraction vectors and their strings
+    size_t segmentTables = 0;   // length, bearings and street ID per segment
+    size_t attractionIndex = 0; // AttractionMapper's name index
+    size_t segmentIndex = 0;    // SegmentMapper's coordinate index and its segment ID vectors
+    size_t turnTable = 0;
+    size_t components = 0;
+    size_t landmarks = 0;       // and segment speeds; only built for some search policies
+    size_t routeCache = 0;
+    size_t closures = 0;        // the closed segment bits and cost factors laid over the map
+    
+    size_t total() const
+    {
+        return segments + streetNames + attractions + segmentTables + attractionIndex + segmentIndex
+             + turnTable + components + landmarks + routeCache + closures;
+    }
+};
+
 class MapLoaderImpl;
 
 class MapLoader
@@ -56,6 +85,16 @@ public:
     bool load(std::string mapFile);
     size_t getNumSegments() const;
     bool getSegment(size_t segNum, StreetSegment& seg) const;
+    // The segment number is a segment's ID everywhere else. These three don't check it.
+    const StreetSegment& getSegmentRef(size_t segNum) const;
+    double getSegmentLength(size_t segNum) const;                       // miles, worked out at load
+    double getSegmentBearing(size_t segNum, bool reverse = false) const; // degrees, as angleOfLine
+    // Street names are interned at load: segments on the same street share one street ID.
+    size_t getStreetId(size_t segNum) const;
+    const std::string& getStreetName(size_t streetId) const;
+    size_t getNumStreets() const;
+    // Adds what this holds to segments, streetNames, attractions and segmentTables
+    void addMemoryUsage(MemoryUsage& usage) const;
     // We prevent a MapLoader object from being copied or assigned.
     MapLoader(const MapLoader&) = delete;
     MapLoader& operator=(const MapLoader&) = delete;
@@ -71,7 +110,23 @@ public:
     AttractionMapper();
     ~AttractionMapper();
     void init(const MapLoader& ml);
-    bool getGeoCoord(std::string attraction, GeoCoord& gc) const;
+    bool getGeoCoord(const std::string& attraction, GeoCoord& gc) const;
+    // getGeoCoord for names[0, count), into coords and found. Returns how many were found;
+    // coords is left alone wherever found is false. Several times the throughput of calling
+    // getGeoCoord in a loop, since the lookups overlap rather than wait on memory one by one.
+    size_t getGeoCoords(const std::string* names, size_t count, GeoCoord* coords, bool* found) const;
+    // By great-circle distance from gc, nearest first. A KD-tree built by init makes these
+    // take about log(attractions) steps plus one per attraction returned.
+    std::vector<Attraction> nearestAttractions(const GeoCoord& gc, size_t k) const;
+    std::vector<Attraction> attractionsWithinRadius(const GeoCoord& gc, double km) const;
+    // Up to k attractions whose names start with prefix (in any case), highest weight first,
+    // then alphabetically. Weights start at 0 and init resets them.
+    std::vector<Attraction> complete(const std::string& prefix, size_t k) const;
+    bool setCompletionWeight(const std::string& attraction, double weight);    // false if there's no such attraction
+    // Up to k attractions within maxEdits single-character edits of name (in any case),
+    // fewest edits first, then alphabetically. Cheap enough to try after every failed getGeoCoord.
+    std::vector<Attraction> fuzzyMatches(const std::string& name, size_t k, size_t maxEdits = 2) const;
+    void addMemoryUsage(MemoryUsage& usage) const;    // to attractionIndex
     // We prevent an AttractionMapper object from being copied or assigned.
     AttractionMapper(const AttractionMapper&) = delete;
     AttractionMapper& operator=(const AttractionMapper&) = delete;
@@ -86,8 +141,12 @@ class SegmentMapper
 public:
     SegmentMapper();
     ~SegmentMapper();
+    // getSegments reads the segments from ml, which has to outlive the SegmentMapper
     void init(const MapLoader& ml);
     std::vector<StreetSegment> getSegments(const GeoCoord& gc) const;
+    // IDs (MapLoader segment numbers) of the segments getSegments would return, without the copies
+    const std::vector<size_t>& getSegmentIds(const GeoCoord& gc) const;
+    void addMemoryUsage(MemoryUsage& usage) const;    // to segmentIndex
     // We prevent a SegmentMapper object from being copied or assigned.
     SegmentMapper(const SegmentMapper&) = delete;
     SegmentMapper& operator=(const SegmentMapper&) = delete;
@@ -121,10 +180,168 @@ public:
     GeoSegment	m_geoSegment;
 };
 
+// The words NavSegment::m_direction can hold, as a number
+enum NavDirection {
+    DIR_EAST, DIR_NORTHEAST, DIR_NORTH, DIR_NORTHWEST, DIR_WEST, DIR_SOUTHWEST, DIR_SOUTH, DIR_SOUTHEAST,
+    DIR_LEFT, DIR_RIGHT
+};
+
+const char* navDirectionText(NavDirection d);   // "east", ..., "left", "right"
+
+// A NavSegment without the strings: what navigateSteps hands out one at a time
+struct NavStep
+{
+    NavSegment::NavCommand command;
+    NavDirection           direction;
+    size_t                 streetId;    // MapLoader::getStreetName / Navigator::getStreetName
+    size_t                 segmentId;   // the segment driven on, or turned onto
+    double                 distance;    // for proceed, in miles; 0 for turn
+};
+
+typedef std::function<void(const NavStep&)> NavStepSink;
+
 enum NavResult {
-    NAV_SUCCESS, NAV_BAD_SOURCE, NAV_BAD_DESTINATION, NAV_NO_ROUTE
+    NAV_SUCCESS, NAV_BAD_SOURCE, NAV_BAD_DESTINATION, NAV_NO_ROUTE,
+    NAV_TIMEOUT,    // the deadline passed before the search finished
+    NAV_CANCELLED   // the query's CancelToken was cancelled
 };
 
+// Copies of a CancelToken share one flag, so the caller can keep a copy and cancel
+// a query that has already been handed off to another thread.
+class CancelToken
+{
+public:
+    CancelToken()
+    : m_flag(std::make_shared<std::atomic<bool> >(false))
+    {}
+    
+    void cancel() { m_flag->store(true); }
+    bool cancelled() const { return m_flag->load(); }
+private:
+    std::shared_ptr<std::atomic<bool> > m_flag;
+};
+
+typedef std::chrono::steady_clock::time_point NavDeadline;
+
+struct NavQuery
+{
+    std::string start;
+    std::string end;
+};
+
+struct NavAnswer
+{
+    NavResult               result = NAV_NO_ROUTE;
+    std::vector<NavSegment> directions;
+};
+
+struct ReachableNode
+{
+    GeoCoord coord;
+    double   distance;  // along the network from the start, in miles like NavSegment::m_distance
+};
+
+struct ReachableAttraction
+{
+    std::string name;
+    GeoCoord    coord;
+    double      distance;
+};
+
+// Everything within reach of a start point, both lists nearest first.
+struct Reachability
+{
+    std::vector<ReachableNode>       nodes;
+    std::vector<ReachableAttraction> attractions;
+};
+
+struct NavRoute
+{
+    double                  distance;   // total, in miles
+    std::vector<NavSegment> directions;
+};
+
+// Extra cost of each kind of turn, in miles of driving it is worth to avoid one.
+// All zero (the default) means turns are free and navigate finds the shortest route.
+struct TurnCosts
+{
+    double left = 0;
+    double right = 0;
+    double uTurn = 0;
+};
+
+// What one segment costs to drive, for Navigator::updateClosures: factor times its length.
+// HUGE_VAL closes the segment and 1 puts it back the way the map has it.
+struct SegmentCostChange
+{
+    size_t segId;
+    double factor;
+};
+
+// One connected piece of the street network
+struct ComponentInfo
+{
+    size_t segments = 0;
+    size_t attractions = 0;
+    double miles = 0;
+};
+
+struct RouteCacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t size = 0;
+    size_t capacity = 0;    // 0 means the cache is off
+};
+
+// What one navigate, navigateSteps or navigatePolyline call did. Times are in microseconds;
+// reconstruction covers walking the path back and building the directions.
+struct NavStats
+{
+    bool cacheHit = false;
+    size_t nodesExpanded = 0;
+    size_t edgesRelaxed = 0;    // neighbours looked at, whether or not they improved
+    size_t heapPushes = 0;
+    size_t heapPops = 0;
+    size_t peakHeap = 0;
+    size_t mapProbes = 0;       // MyMap lookups and inserts, the route cache's included
+    size_t nameLookups = 0;     // attraction names looked up in AttractionMapper's hash
+    size_t bytesAllocated = 0;  // taken from the allocator: search buffers that grew, map entries and the route
+    double routeCost = 0;       // the route's cost as the search counted it, turn costs and cost factors included,
+                                // in Navigator::costUnit()
+    double lookupMicros = 0;
+    double searchMicros = 0;
+    double reconstructMicros = 0;
+    double totalMicros = 0;
+};
+
+// Every query's NavStats, added up across all threads since stats were enabled or reset.
+// Histogram bucket 0 counts zeros and bucket i counts values in [2^(i-1), 2^i).
+struct NavStatsSummary
+{
+    static const int BUCKETS = 40;
+    size_t queries = 0;
+    size_t cacheHits = 0;
+    size_t totalMicros[BUCKETS] = {};
+    size_t nodesExpanded[BUCKETS] = {};
+};
+
+// Stats are off by default, and then cost a couple of integer adds per node expanded.
+// When on, each query's NavStats can be read back on the thread that ran it.
+void enableNavStats(bool enabled);
+bool navStatsEnabled();
+const NavStats& lastNavStats();     // this thread's most recent query
+NavStatsSummary navStatsSummary();
+void resetNavStats();
+
+// Timeline of where time goes: map loading, each mapper's init, and the lookup, search and
+// reconstruction of every query, per thread. Each thread keeps its last 16384 spans.
+// traceJson gives them in Chrome trace-event format, for chrome://tracing or Perfetto.
+void enableTracing(bool enabled);
+std::string traceJson();
+void clearTrace();
+
 class NavigatorImpl;
 
 class Navigator
@@ -133,12 +350,121 @@ public:
     Navigator();
     ~Navigator();
     bool loadMapData(std::string mapFile);
+    // What NavStats::routeCost is given in: "miles", or "hours" when built with
+    // NAV_METRIC=TimeMetric. NAV_UNITS doesn't change it.
+    static const char* costUnit();
     NavResult navigate(std::string start, std::string end, std::vector<NavSegment>& directions) const;
+    // The search checks the deadline and the token as it goes and gives up with
+    // NAV_TIMEOUT or NAV_CANCELLED rather than running to completion.
+    NavResult navigate(std::string start, std::string end, std::vector<NavSegment>& directions,
+                       NavDeadline deadline, const CancelToken& cancel = CancelToken()) const;
+    // Also fills stats, whether or not enableNavStats is on
+    NavResult navigate(std::string start, std::string end, std::vector<NavSegment>& directions, NavStats& stats) const;
+    // Same route as navigate, handed to sink one step at a time instead of built up in a vector.
+    // Nothing is sent unless the result is NAV_SUCCESS.
+    NavResult navigateSteps(std::string start, std::string end, const NavStepSink& sink,
+                            NavDeadline deadline = NavDeadline::max(), const CancelToken& cancel = CancelToken()) const;
+    const std::string& getStreetName(size_t streetId) const;
+    // The route's geometry, start to end, as one encodePolyline string
+    NavResult navigatePolyline(std::string start, std::string end, std::string& polyline, int precision = 5) const;
+    // Everything whose network distance from start is at most maxDistance miles.
+    // Returns NAV_SUCCESS, NAV_BAD_SOURCE, or NAV_TIMEOUT/NAV_CANCELLED under the given limits.
+    NavResult reachable(std::string start, double maxDistance, Reachability& result,
+                        NavDeadline deadline = NavDeadline::max(), const CancelToken& cancel = CancelToken()) const;
+    // Up to k routes, best first. Each is at most maxStretch times as long as the best one,
+    // and at most maxOverlap of its length is on roads used by the routes listed before it,
+    // taken together. Returns NAV_TIMEOUT/NAV_CANCELLED, with no routes, under the given limits.
+    NavResult alternatives(std::string start, std::string end, size_t k, std::vector<NavRoute>& routes,
+                           double maxStretch = 1.25, double maxOverlap = 0.6,
+                           NavDeadline deadline = NavDeadline::max(), const CancelToken& cancel = CancelToken()) const;
+    // Connected pieces of the network, labelled at load. Routes only exist within one,
+    // so navigate answers NAV_NO_ROUTE between two without searching.
+    size_t getNumComponents() const;
+    std::vector<ComponentInfo> getComponentStats() const;    // indexed by component number
+    MemoryUsage memoryUsage() const;
+    // What the user may have meant by a name navigate answered NAV_BAD_SOURCE or
+    // NAV_BAD_DESTINATION to; see AttractionMapper::fuzzyMatches
+    std::vector<Attraction> suggestAttractions(std::string name, size_t k = 5, size_t maxEdits = 2) const;
+    // Only navigate takes turn costs into account; reachable and alternatives stay distance-only.
+    // Safe while queries run: each uses the costs that were set when it started.
+    void setTurnCosts(const TurnCosts& costs);
+    // Closures and slowdowns laid over the loaded map, for roadworks and the like; loadMapData
+    // drops them. The changes are made all at once, and may be made while queries are running:
+    // a query sees the segments as they were when it started. Closed segments are avoided by
+    // navigate, reachable and alternatives; factors, like turn costs, only matter to navigate.
+    // False, and nothing changes, if a factor is below 1 or a segment doesn't exist.
+    bool updateClosures(const std::vector<SegmentCostChange>& changes);
+    void clearClosures();
+    double getSegmentCostFactor(size_t segId) const;   // 1 unless changed; HUGE_VAL if closed
+    // Routes are remembered per (start, end) pair, least recently used first out.
+    // The cache is off until a nonzero capacity is set, and is emptied on loadMapData.
+    void setRouteCacheCapacity(size_t capacity);
+    RouteCacheStats getRouteCacheStats() const;
+    // Runs the query on its own thread. The Navigator must outlive the future.
+    std::future<NavAnswer> navigateAsync(std::string start, std::string end,
+                                         NavDeadline deadline = NavDeadline::max(),
+                                         const CancelToken& cancel = CancelToken()) const;
     // We prevent a Navigator object from being copied or assigned.
     Navigator(const Navigator&) = delete;
     Navigator& operator=(const Navigator&) = delete;
 private:
     NavigatorImpl* m_impl;
+    friend class RerouteSession;
+};
+
+class RerouteSessionImpl;
+
+// One trip, re-planned as it goes. The search behind the last route is kept (D* Lite, from
+// the destination back), so when the vehicle strays or a segment's cost changes, update
+// only searches again where the change makes a difference. Distance only, like reachable:
+// no turn costs. One thread at a time; the Navigator must outlive the session and keep its map.
+// The Navigator's closures aren't seen here: a session has setSegmentCostFactor instead.
+class RerouteSession
+{
+public:
+    RerouteSession(const Navigator& nav);
+    ~RerouteSession();
+    NavResult begin(std::string start, std::string end, std::vector<NavSegment>& directions);
+    // The vehicle is now at gc, a segment end or attraction; false if it's neither, or before begin
+    bool moveTo(const GeoCoord& gc);
+    // Segment segId costs factor times its length from now on (HUGE_VAL closes it). This
+    // lasts for the whole session, begin included; false if factor < 1 or there's no such segment.
+    bool setSegmentCostFactor(size_t segId, double factor);
+    // The route from where the vehicle is now, after moves and cost changes
+    NavResult update(std::vector<NavSegment>& directions);
+    double routeCost() const;       // of the last route, in miles with the factors applied
+    size_t nodesExpanded() const;   // by the last begin or update
+    // We prevent a RerouteSession object from being copied or assigned.
+    RerouteSession(const RerouteSession&) = delete;
+    RerouteSession& operator=(const RerouteSession&) = delete;
+private:
+    RerouteSessionImpl* m_impl;
+};
+
+class NavigatorPoolImpl;
+
+// Runs navigate queries on a fixed set of worker threads that all share one loaded map.
+// loadMapData must not be called while queries are still outstanding.
+class NavigatorPool
+{
+public:
+    NavigatorPool(size_t numThreads = 0);   // 0 means one thread per core
+    ~NavigatorPool();
+    bool loadMapData(std::string mapFile);
+    std::future<NavAnswer> submit(std::string start, std::string end);
+    // A query still queued when its deadline passes is answered NAV_TIMEOUT without being searched.
+    std::future<NavAnswer> submit(std::string start, std::string end, NavDeadline deadline,
+                                  const CancelToken& cancel = CancelToken());
+    std::vector<NavAnswer> navigateAll(const std::vector<NavQuery>& queries);
+    size_t numThreads() const;
+    const Navigator& navigator() const;
+    // Unlike loadMapData, doesn't wait for outstanding queries; see Navigator::updateClosures
+    bool updateClosures(const std::vector<SegmentCostChange>& changes);
+    // We prevent a NavigatorPool object from being copied or assigned.
+    NavigatorPool(const NavigatorPool&) = delete;
+    NavigatorPool& operator=(const NavigatorPool&) = delete;
+private:
+    NavigatorPoolImpl* m_impl;
 };
 
 // Tools for computing distance between GeoCoords, angle of a GeoSegment,
@@ -205,4 +531,22 @@ inline double angleOfLine(const GeoSegment& line1)
     return result;
 }
 
+// Batch versions of distanceEarthKM, distanceEarthMiles and angleOfLine over arrays of
+// coordinates: out[i] is for the line from (lat1[i], lon1[i]) to (lat2[i], lon2[i]), in degrees.
+// Built with AVX2 and FMA they do four lines at a time with polynomial sin/cos/atan2, and
+// stay within 2e-9 km (distance) and 1e-13 degrees (angle) of the scalar versions.
+void distanceEarthKMBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                          double* out, size_t n);
+void distanceEarthMilesBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                             double* out, size_t n);
+void angleOfLineBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                      double* out, size_t n);
+
+// Encoded polyline, as in the Google Maps polyline format: each coordinate is rounded to
+// precision decimal places (5 is the usual, 0 to 9 allowed), stored as the difference from
+// the previous point, zigzag-encoded and written 5 bits per printable character.
+std::string encodePolyline(const double* lat, const double* lon, size_t n, int precision = 5);
+// False if s is not a well-formed polyline; lat and lon are replaced either way.
+bool decodePolyline(const std::string& s, std::vector<double>& lat, std::vector<double>& lon, int precision = 5);
+
 #endif // PROVIDED_INCLUDED
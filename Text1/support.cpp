@@ -8,6 +8,17 @@
 
 #include <stdio.h>
 #include "provided.h"
+#include "support.h"
+#include <cctype>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
 
 bool operator==(const GeoCoord& a, const GeoCoord& b)
 {
@@ -78,32 +89,614 @@ bool operator>(const GeoCoord& a, const GeoCoord& b)
 
 std::string dirTurn(double angle)
 {
-    if (angle<180)
-        return "left";
-    return "right";
+    return navDirectionText(turnDirection(angle));
 }
 
 
 std::string dirProc(double angle)
+{
+    return navDirectionText(compassDirection(angle));
+}
+
+NavDirection turnDirection(double angle)
+{
+    if (angle<180)
+        return DIR_LEFT;
+    return DIR_RIGHT;
+}
+
+NavDirection compassDirection(double angle)
 {
     if (angle>=0 && angle<= 22.5)
-        return "east";
+        return DIR_EAST;
     if (angle>22.5&& angle<=67.5)
-        return "northeast";
+        return DIR_NORTHEAST;
     if (angle>67.5&& angle<=112.5)
-        return "north";
+        return DIR_NORTH;
     if (angle>112.5&& angle<=157.5)
-        return "northwest";
+        return DIR_NORTHWEST;
     if (angle>157.5 &&angle<=202.5)
-        return "west";
+        return DIR_WEST;
     if (angle>202.5 && angle<=247.5)
-        return "southwest";
+        return DIR_SOUTHWEST;
     if (angle>247.5&& angle<=292.5)
-        return "south";
+        return DIR_SOUTH;
     if (angle<=337.5)
-        return "southeast";
+        return DIR_SOUTHEAST;
     else
-        return "east"; //I'm not really paying attention to the 360 here, should I?
+        return DIR_EAST; //I'm not really paying attention to the 360 here, should I?
                         //might want to go back and fix.
 
 }
+
+const char* navDirectionText(NavDirection d)
+{
+    static const char* const text[] = {
+        "east", "northeast", "north", "northwest", "west", "southwest", "south", "southeast",
+        "left", "right"
+    };
+    return text[d];
+}
+
+std::string toLowerCase(std::string s)
+{
+    for (size_t i = 0; i != s.size(); i++)
+    {
+        if (isupper(s[i]))
+            s[i] = tolower(s[i]);
+    }
+    return s;
+}
+
+//******************** case-folded hashing ************************************
+
+// Sixteen bytes at a time with SSE2, eight at a time in a plain 64-bit word otherwise. Both
+// fold the same bytes into the same words, so the hash doesn't depend on which was built.
+// Like toLowerCase (in the C locale), only A-Z change.
+
+#if defined(__SSE2__)
+#define FOLD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Each byte of w from A to Z gets its 0x20 bit set
+inline uint64_t foldWord(uint64_t w)
+{
+    const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    uint64_t low7 = w & ~highs;
+    uint64_t atLeastA = low7 + (0x80 - 'A') * ones;    //high bit set where the byte is >= 'A'
+    uint64_t pastZ = low7 + (0x80 - 'Z' - 1) * ones;   //and where it's > 'Z'
+    uint64_t upper = atLeastA & ~pastZ & ~w & highs;   //~w leaves out bytes from 0x80 up
+    return w | (upper >> 2);
+}
+
+#ifdef FOLD_SSE2
+inline __m128i foldBlock(__m128i v)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+inline uint64_t mixWord(uint64_t h, uint64_t w)
+{
+    h ^= w * 0x9E3779B97F4A7C15ULL;
+    return ((h << 29) | (h >> 35)) * 0xBF58476D1CE4E5B9ULL;
+}
+
+} // namespace
+
+uint64_t foldedHash(const char* s, size_t n, uint64_t seed)
+{
+    uint64_t h = seed ^ (n * 0x94D049BB133111EBULL);
+    size_t i = 0;
+#ifdef FOLD_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        uint64_t words[2];
+        _mm_storeu_si128((__m128i*)words, foldBlock(_mm_loadu_si128((const __m128i*)(s + i))));
+        h = mixWord(mixWord(h, words[0]), words[1]);
+    }
+#endif
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t w;
+        std::memcpy(&w, s + i, 8);
+        h = mixWord(h, foldWord(w));
+    }
+    if (i != n)
+    {
+        uint64_t w = 0;
+        std::memcpy(&w, s + i, n - i);
+        h = mixWord(h, foldWord(w));
+    }
+    h ^= h >> 31; //splitmix64's finish, so every input bit reaches the low bits too
+    h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 29);
+}
+
+bool foldedEquals(const char* s, size_t n, const char* lower, size_t lowerLength)
+{
+    if (n != lowerLength)
+        return false;
+    size_t i = 0;
+#ifdef FOLD_SSE2
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i a = foldBlock(_mm_loadu_si128((const __m128i*)(s + i)));
+        __m128i b = _mm_loadu_si128((const __m128i*)(lower + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff)
+            return false;
+    }
+#endif
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t a, b;
+        std::memcpy(&a, s + i, 8);
+        std::memcpy(&b, lower + i, 8);
+        if (foldWord(a) != b)
+            return false;
+    }
+    for (; i != n; i++)
+    {
+        char c = s[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != lower[i])
+            return false;
+    }
+    return true;
+}
+
+//******************** batch distance and bearing kernels *********************
+
+// Four coordinate pairs at a time when built with AVX2 and FMA (e.g. -mavx2 -mfma or
+// -march=native); otherwise a plain loop over the scalar formulas. The AVX2 path uses its
+// own sin/cos/atan2 so nothing in the loop is a libm call.
+
+#if defined(__AVX2__) && defined(__FMA__)
+#define BATCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const double DEG2RAD = 0.017453292519943295769;  // pi / 180
+const double RAD2DEG = 57.295779513082320877;
+
+// distanceEarthKM and angleOfLine on bare degrees, for the leftovers after the last full vector
+inline double haversineKM(double lat1d, double lon1d, double lat2d, double lon2d)
+{
+    double lat1r = lat1d * DEG2RAD;
+    double lat2r = lat2d * DEG2RAD;
+    double u = std::sin((lat2d - lat1d) * (DEG2RAD / 2));
+    double v = std::sin((lon2d - lon1d) * (DEG2RAD / 2));
+    return 2.0 * 6371.0 * std::asin(std::sqrt(u * u + std::cos(lat1r) * std::cos(lat2r) * v * v));
+}
+
+inline double bearingDeg(double lat1d, double lon1d, double lat2d, double lon2d)
+{
+    double result = std::atan2(lat2d - lat1d, lon2d - lon1d) * RAD2DEG;
+    if (result < 0)
+        result += 360;
+    return result;
+}
+
+#ifdef BATCH_AVX2
+
+// Polynomial evaluation, highest coefficient first
+inline __m256d horner(__m256d x, const double* c, int n)
+{
+    __m256d r = _mm256_set1_pd(c[0]);
+    for (int i = 1; i < n; i++)
+        r = _mm256_fmadd_pd(r, x, _mm256_set1_pd(c[i]));
+    return r;
+}
+
+// sin and cos of x for |x| up to a few pi. x is reduced to r in [-pi/4, pi/4] by a multiple
+// q of pi/2 (subtracted in two pieces so r keeps full precision), Taylor polynomials are
+// used on r, and q mod 4 picks and signs the results.
+inline void sincos4(__m256d x, __m256d& s, __m256d& c)
+{
+    static const double sinC[] = { -1.0/1307674368000, 1.0/6227020800, -1.0/39916800, 1.0/362880,
+                                   -1.0/5040, 1.0/120, -1.0/6 };
+    static const double cosC[] = { 1.0/20922789888000, -1.0/87178291200, 1.0/479001600, -1.0/3628800,
+                                   1.0/40320, -1.0/720, 1.0/24, -0.5, 1.0 };
+    __m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(0.63661977236758134308)),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_fnmadd_pd(q, _mm256_set1_pd(1.57079632673412561417e+00), x);
+    r = _mm256_fnmadd_pd(q, _mm256_set1_pd(6.07710050650619224932e-11), r);
+    __m256d z = _mm256_mul_pd(r, r);
+    __m256d sr = _mm256_fmadd_pd(_mm256_mul_pd(z, r), horner(z, sinC, 7), r);
+    __m256d cr = horner(z, cosC, 9);
+    
+    __m256i qi = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(q));
+    __m256i one = _mm256_set1_epi64x(1), two = _mm256_set1_epi64x(2);
+    __m256d swap = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(qi, one), one));
+    __m256d sinSign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(qi, two), 62));
+    __m256d cosSign = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(qi, one), two), 62));
+    s = _mm256_xor_pd(_mm256_blendv_pd(sr, cr, swap), sinSign);
+    c = _mm256_xor_pd(_mm256_blendv_pd(cr, sr, swap), cosSign);
+}
+
+// atan2(y, x). atan is only ever taken of min(|x|,|y|) / max(|x|,|y|), which is in [0, 1];
+// above 0.66 it is moved next to 0 by atan(t) = pi/4 + atan((t-1)/(t+1)), and the Cephes
+// rational approximation does the rest. Quadrants are put back by reflection.
+inline __m256d atan2_4(__m256d y, __m256d x)
+{
+    static const double P[] = { -8.750608600031904122785E-1, -1.615753718733365076637E1,
+                                 -7.500855792314704667340E1, -1.228866684490136173410E2,
+                                 -6.485021904942025371773E1 };
+    static const double Q[] = { 1.0, 2.485846490142306297962E1, 1.650270098316988542046E2,
+                                4.328810604912902668951E2, 4.853903996359136964868E2,
+                                1.945506571482613964425E2 };
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d ax = _mm256_andnot_pd(signBit, x);
+    __m256d ay = _mm256_andnot_pd(signBit, y);
+    __m256d lo = _mm256_min_pd(ax, ay);
+    __m256d hi = _mm256_max_pd(ax, ay);
+    __m256d t = _mm256_div_pd(lo, hi);
+    t = _mm256_blendv_pd(t, zero, _mm256_cmp_pd(hi, zero, _CMP_EQ_OQ)); //atan2(0, 0) is 0
+    
+    __m256d big = _mm256_cmp_pd(t, _mm256_set1_pd(0.66), _CMP_GT_OQ);
+    const __m256d one = _mm256_set1_pd(1.0);
+    t = _mm256_blendv_pd(t, _mm256_div_pd(_mm256_sub_pd(t, one), _mm256_add_pd(t, one)), big);
+    __m256d base = _mm256_and_pd(big, _mm256_set1_pd(0.78539816339744830962));
+    __m256d more = _mm256_and_pd(big, _mm256_set1_pd(0.5 * 6.123233995736765886130E-17));
+    
+    __m256d z = _mm256_mul_pd(t, t);
+    __m256d ratio = _mm256_div_pd(_mm256_mul_pd(z, horner(z, P, 5)), horner(z, Q, 6));
+    __m256d a = _mm256_add_pd(base, _mm256_add_pd(_mm256_fmadd_pd(t, ratio, t), more));
+    
+    const __m256d halfPi = _mm256_set1_pd(1.57079632679489661923);
+    const __m256d pi = _mm256_set1_pd(3.14159265358979323846);
+    a = _mm256_blendv_pd(a, _mm256_sub_pd(halfPi, a), _mm256_cmp_pd(ay, ax, _CMP_GT_OQ));
+    a = _mm256_blendv_pd(a, _mm256_sub_pd(pi, a), x); //sign bit of x selects
+    return _mm256_or_pd(a, _mm256_and_pd(y, signBit));
+}
+
+inline __m256d haversine4(__m256d la1, __m256d lo1, __m256d la2, __m256d lo2)
+{
+    const __m256d d2r = _mm256_set1_pd(DEG2RAD);
+    const __m256d halfD2r = _mm256_set1_pd(DEG2RAD / 2);
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d su, cu, sv, cv, s1, c1, s2, c2;
+    sincos4(_mm256_mul_pd(_mm256_sub_pd(la2, la1), halfD2r), su, cu);
+    sincos4(_mm256_mul_pd(_mm256_sub_pd(lo2, lo1), halfD2r), sv, cv);
+    sincos4(_mm256_mul_pd(la1, d2r), s1, c1);
+    sincos4(_mm256_mul_pd(la2, d2r), s2, c2);
+    __m256d h = _mm256_fmadd_pd(_mm256_mul_pd(c1, c2), _mm256_mul_pd(sv, sv), _mm256_mul_pd(su, su));
+    h = _mm256_min_pd(h, one);
+    //2 asin(sqrt(h)) == 2 atan2(sqrt(h), sqrt(1 - h))
+    __m256d d = atan2_4(_mm256_sqrt_pd(h), _mm256_sqrt_pd(_mm256_sub_pd(one, h)));
+    return _mm256_mul_pd(_mm256_set1_pd(2.0 * 6371.0), d);
+}
+
+#endif // BATCH_AVX2
+
+} // namespace
+
+void distanceEarthKMBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                          double* out, size_t n)
+{
+    size_t i = 0;
+#ifdef BATCH_AVX2
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, haversine4(_mm256_loadu_pd(lat1 + i), _mm256_loadu_pd(lon1 + i),
+                                             _mm256_loadu_pd(lat2 + i), _mm256_loadu_pd(lon2 + i)));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = haversineKM(lat1[i], lon1[i], lat2[i], lon2[i]);
+}
+
+void distanceEarthMilesBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                             double* out, size_t n)
+{
+    const double milesPerKm = 0.621371;
+    distanceEarthKMBatch(lat1, lon1, lat2, lon2, out, n);
+    for (size_t i = 0; i < n; i++)
+        out[i] *= milesPerKm;
+}
+
+void angleOfLineBatch(const double* lat1, const double* lon1, const double* lat2, const double* lon2,
+                      double* out, size_t n)
+{
+    size_t i = 0;
+#ifdef BATCH_AVX2
+    const __m256d r2d = _mm256_set1_pd(RAD2DEG);
+    const __m256d full = _mm256_set1_pd(360.0);
+    const __m256d zero = _mm256_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d dlat = _mm256_sub_pd(_mm256_loadu_pd(lat2 + i), _mm256_loadu_pd(lat1 + i));
+        __m256d dlon = _mm256_sub_pd(_mm256_loadu_pd(lon2 + i), _mm256_loadu_pd(lon1 + i));
+        __m256d deg = _mm256_mul_pd(atan2_4(dlat, dlon), r2d);
+        deg = _mm256_add_pd(deg, _mm256_and_pd(_mm256_cmp_pd(deg, zero, _CMP_LT_OQ), full));
+        _mm256_storeu_pd(out + i, deg);
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = bearingDeg(lat1[i], lon1[i], lat2[i], lon2[i]);
+}
+
+//******************** encoded polylines **************************************
+
+namespace {
+
+const double POWERS_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+// llround without the library call: half away from zero, like llround
+inline long long roundToLong(double x)
+{
+    return static_cast<long long>(x < 0 ? x - 0.5 : x + 0.5);
+}
+
+// The zigzag value in 5-bit chunks, low chunk first, each chunk but the last with 0x20 set,
+// and 63 added to make it printable
+inline char* encodeValue(long long v, char* out)
+{
+    unsigned long long u = static_cast<unsigned long long>(v) << 1;
+    if (v < 0)
+        u = ~u;
+    while (u >= 0x20)
+    {
+        *out++ = static_cast<char>((0x20 | (u & 0x1f)) + 63);
+        u >>= 5;
+    }
+    *out++ = static_cast<char>(u + 63);
+    return out;
+}
+
+inline bool decodeValue(const char*& p, const char* end, long long& v)
+{
+    unsigned long long u = 0;
+    int shift = 0;
+    for (;;)
+    {
+        if (p == end || shift > 60)
+            return false;
+        int c = *p++ - 63;
+        if (c < 0 || c > 63)
+            return false;
+        u |= static_cast<unsigned long long>(c & 0x1f) << shift;
+        shift += 5;
+        if (c < 0x20)
+            break;
+    }
+    v = (u & 1) ? ~static_cast<long long>(u >> 1) : static_cast<long long>(u >> 1);
+    return true;
+}
+
+} // namespace
+
+std::string encodePolyline(const double* lat, const double* lon, size_t n, int precision)
+{
+    if (precision < 0 || precision > 9)
+        return std::string();
+    double factor = POWERS_OF_TEN[precision];
+    // Street-scale steps take 2-4 characters per number, but any delta can take up to 13, so
+    // start with room for the usual case and grow whenever a worst-case point might not fit.
+    const size_t WORST_POINT = 2 * 13;
+    std::string result(n * 8 + WORST_POINT, '\0');
+    char* out = &result[0];
+    char* limit = out + result.size() - WORST_POINT;
+    long long prevLat = 0, prevLon = 0;
+    for (size_t i = 0; i != n; i++)
+    {
+        if (out > limit)
+        {
+            size_t used = out - result.data();
+            result.resize(result.size() * 2);
+            out = &result[0] + used;
+            limit = &result[0] + result.size() - WORST_POINT;
+        }
+        long long la = roundToLong(lat[i] * factor);
+        long long lo = roundToLong(lon[i] * factor);
+        out = encodeValue(la - prevLat, out);
+        out = encodeValue(lo - prevLon, out);
+        prevLat = la;
+        prevLon = lo;
+    }
+    result.resize(out - result.data());
+    return result;
+}
+
+bool decodePolyline(const std::string& s, std::vector<double>& lat, std::vector<double>& lon, int precision)
+{
+    lat.clear();
+    lon.clear();
+    if (precision < 0 || precision > 9)
+        return false;
+    double factor = POWERS_OF_TEN[precision];
+    const char* p = s.data();
+    const char* end = p + s.size();
+    long long la = 0, lo = 0;
+    while (p != end)
+    {
+        long long dLat, dLon;
+        if (! decodeValue(p, end, dLat) || ! decodeValue(p, end, dLon))
+            return false;
+        la += dLat;
+        lo += dLon;
+        lat.push_back(la / factor);
+        lon.push_back(lo / factor);
+    }
+    return true;
+}
+
+//******************** memory accounting ****************************************
+
+size_t heapBytes(const std::string& s)
+{
+    const char* inside = reinterpret_cast<const char*>(&s);
+    if (s.data() >= inside && s.data() < inside + sizeof(s)) //short string, kept in the object
+        return 0;
+    return s.capacity() + 1;
+}
+
+size_t heapBytes(const GeoCoord& gc)
+{
+    return heapBytes(gc.latitudeText) + heapBytes(gc.longitudeText);
+}
+
+size_t heapBytes(const Attraction& a)
+{
+    return heapBytes(a.name) + heapBytes(a.geocoordinates);
+}
+
+size_t heapBytes(const std::vector<Attraction>& attractions)
+{
+    size_t bytes = attractions.capacity() * sizeof(Attraction);
+    for (size_t i = 0; i != attractions.size(); i++)
+        bytes += heapBytes(attractions[i]);
+    return bytes;
+}
+
+//******************** tracing **************************************************
+
+// Each thread writes spans into its own ring, so recording takes no lock: the slot's fields
+// are stored, then the head is bumped. traceJson reads every ring's head, copies the slots,
+// and throws away any the writer may have lapped while it was copying. Rings are shared with
+// the registry, so spans from threads that have finished still show up.
+
+std::atomic<bool> g_traceEnabled(false);
+
+namespace {
+
+const size_t TRACE_RING = 16384; // a power of two
+
+struct TraceSpan
+{
+    std::atomic<const char*> name;
+    std::atomic<long long> start, end;
+};
+
+struct TraceRing
+{
+    TraceRing(int id)
+    : tid(id), head(0), cleared(0), spans(TRACE_RING)
+    {}
+    
+    int tid;
+    std::atomic<size_t> head; //spans ever written; the next goes at head % TRACE_RING
+    std::atomic<size_t> cleared; //spans before this were thrown away by clearTrace
+    std::vector<TraceSpan> spans;
+};
+
+std::atomic<int> g_traceThreads(0);
+std::mutex g_traceRingsMutex;
+std::vector<std::shared_ptr<TraceRing> > g_traceRings;
+const std::chrono::steady_clock::time_point g_traceEpoch = std::chrono::steady_clock::now();
+
+TraceRing& traceRing()
+{
+    static thread_local std::shared_ptr<TraceRing> ring;
+    if (! ring)
+    {
+        std::lock_guard<std::mutex> lock(g_traceRingsMutex);
+        ring = std::make_shared<TraceRing>(++g_traceThreads);
+        g_traceRings.push_back(ring);
+    }
+    return *ring;
+}
+
+// Names are literals from our own code, but escape them anyway
+void writeJsonString(std::ostringstream& out, const char* s)
+{
+    out << '"';
+    for (; *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            out << '\\' << *s;
+        else if ((unsigned char)*s >= 0x20)
+            out << *s;
+    }
+    out << '"';
+}
+
+} // namespace
+
+long long traceNowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_traceEpoch).count();
+}
+
+void traceRecord(const char* name, long long startNanos, long long endNanos)
+{
+    TraceRing& ring = traceRing();
+    size_t h = ring.head.load(std::memory_order_relaxed);
+    TraceSpan& span = ring.spans[h & (TRACE_RING - 1)];
+    span.name.store(name, std::memory_order_relaxed);
+    span.start.store(startNanos, std::memory_order_relaxed);
+    span.end.store(endNanos, std::memory_order_relaxed);
+    ring.head.store(h + 1, std::memory_order_release);
+}
+
+void enableTracing(bool enabled)
+{
+    g_traceEnabled = enabled;
+}
+
+std::string traceJson()
+{
+    std::vector<std::shared_ptr<TraceRing> > rings;
+    {
+        std::lock_guard<std::mutex> lock(g_traceRingsMutex);
+        rings = g_traceRings;
+    }
+    
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed << "{\"traceEvents\":[";
+    bool first = true;
+    for (size_t r = 0; r != rings.size(); r++)
+    {
+        TraceRing& ring = *rings[r];
+        size_t head = ring.head.load(std::memory_order_acquire);
+        size_t from = std::max(head > TRACE_RING ? head - TRACE_RING : 0, ring.cleared.load());
+        std::vector<const char*> names;
+        std::vector<long long> starts, ends;
+        for (size_t i = from; i != head; i++)
+        {
+            TraceSpan& span = ring.spans[i & (TRACE_RING - 1)];
+            names.push_back(span.name.load(std::memory_order_relaxed));
+            starts.push_back(span.start.load(std::memory_order_relaxed));
+            ends.push_back(span.end.load(std::memory_order_relaxed));
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        size_t after = ring.head.load(std::memory_order_relaxed);
+        size_t safe = after > TRACE_RING ? after - TRACE_RING + 1 : 0; //slots before this may have been rewritten
+        
+        for (size_t i = std::max(from, safe); i < head; i++)
+        {
+            size_t k = i - from;
+            out << (first ? "" : ",") << "\n{\"name\":";
+            writeJsonString(out, names[k]);
+            out << ",\"cat\":\"nav\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.tid
+                << ",\"ts\":" << starts[k] / 1000.0 << ",\"dur\":" << (ends[k] - starts[k]) / 1000.0 << "}";
+            first = false;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.str();
+}
+
+void clearTrace()
+{
+    std::lock_guard<std::mutex> lock(g_traceRingsMutex);
+    std::vector<std::shared_ptr<TraceRing> > live;
+    for (size_t r = 0; r != g_traceRings.size(); r++)
+    {
+        if (g_traceRings[r].use_count() == 1) //its thread is gone, and so is everything it had to say
+            continue;
+        g_traceRings[r]->cleared = g_traceRings[r]->head.load();
+        live.push_back(g_traceRings[r]);
+    }
+    g_traceRings.swap(live);
+}
@@ -10,6 +10,12 @@
 #define support_h
 #include "provided.h"
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
 
 
 
@@ -22,6 +28,119 @@ bool operator>(const GeoCoord& a, const GeoCoord& b);
 
 std::string dirTurn(double angle);
 std::string dirProc(double angle);
+NavDirection turnDirection(double angle);
+NavDirection compassDirection(double angle);
+
+std::string toLowerCase(std::string s); //attraction names are looked up case-insensitively
+// The hash of toLowerCase(std::string(s, n)), and whether that equals lower (which must
+// already be lowercase), without making the copy
+uint64_t foldedHash(const char* s, size_t n, uint64_t seed);
+bool foldedEquals(const char* s, size_t n, const char* lower, size_t lowerLength);
+
+// Memory accounting (see Navigator::memoryUsage). A MemoryCounter holds the bytes some
+// structure has allocated and not yet freed, and all it has ever allocated; containers built
+// with a TrackingAllocator on it keep both up to date. The allocator is propagated on copy,
+// move and swap, so a container assigned into (say, a MyMap value) goes on counting against
+// the same counter.
+struct MemoryCounter
+{
+    MemoryCounter()
+    : bytes(0), allocated(0)
+    {}
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> allocated; //never goes down, so the difference across a search is what it took
+};
+
+template<typename T>
+class TrackingAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    
+    TrackingAllocator(MemoryCounter* counter = nullptr)
+    : m_counter(counter)
+    {}
+    template<typename U>
+    TrackingAllocator(const TrackingAllocator<U>& other)
+    : m_counter(other.counter())
+    {}
+    
+    T* allocate(size_t n)
+    {
+        T* p = std::allocator<T>().allocate(n);
+        if (m_counter != nullptr)
+        {
+            m_counter->bytes += n * sizeof(T);
+            m_counter->allocated += n * sizeof(T);
+        }
+        return p;
+    }
+    void deallocate(T* p, size_t n)
+    {
+        if (m_counter != nullptr)
+            m_counter->bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    
+    MemoryCounter* counter() const
+    {
+        return m_counter;
+    }
+private:
+    MemoryCounter* m_counter;
+};
+
+template<typename T, typename U>
+bool operator==(const TrackingAllocator<T>& a, const TrackingAllocator<U>& b)
+{
+    return a.counter() == b.counter();
+}
+
+template<typename T, typename U>
+bool operator!=(const TrackingAllocator<T>& a, const TrackingAllocator<U>& b)
+{
+    return a.counter() != b.counter();
+}
+
+template<typename T>
+using TrackedVector = std::vector<T, TrackingAllocator<T> >;
+
+// The heap blocks held inside the public structs, which use the plain allocator: a string's
+// buffer unless it fits in the string itself, a vector's capacity, and what its elements hold.
+size_t heapBytes(const std::string& s);
+size_t heapBytes(const GeoCoord& gc);
+size_t heapBytes(const Attraction& a);
+size_t heapBytes(const std::vector<Attraction>& attractions);
+
+// Tracing (see enableTracing in provided.h). A TraceScope records how long its block took,
+// under name, which must be a string literal; when tracing is off it does nothing else.
+extern std::atomic<bool> g_traceEnabled;
+long long traceNowNanos();
+void traceRecord(const char* name, long long startNanos, long long endNanos);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+    : m_name(g_traceEnabled.load(std::memory_order_relaxed) ? name : nullptr), m_start(0)
+    {
+        if (m_name != nullptr)
+            m_start = traceNowNanos();
+    }
+    ~TraceScope()
+    {
+        if (m_name != nullptr)
+            traceRecord(m_name, m_start, traceNowNanos());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+private:
+    const char* m_name;
+    long long m_start;
+};
 
 
 #endif /* support_h */